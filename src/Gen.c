@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "List.h"
+#include "Gen.h"
+#include "nerv.h"
+
+/*
+    Synthetic programs for scaling benchmarks
+
+    A program is a run of blocks, each made so it can't get stuck or leave the first span cells:
+
+        arithmetic    +++ or --- on some cell
+        move          >>>> or <<< to some cell
+        clear         [-] or [+]
+        mul           [->++>+++<<], the loop cell goes down by 1 and the pointer comes back
+        io            . or ,
+        scan          [>] or [<<], only where a 0 is known to stop it
+        nest          a counted loop, [-]+++[ blocks -] with nothing in the blocks writing the count
+
+    The pointer is always somewhere known: every block but a scan leaves it in the same place
+    whatever the cells hold. Top level blocks are run on a copy of the tape as they're written,
+    so a scan there knows where the nearest 0 is and where it will stop. Scans aren't put
+    inside nests, where the tape differs from one iteration to the next.
+
+    A program that reads nothing is all constants, and Const_Prop folds most of it away before
+    it runs. So , reads input, made up as the copy of the tape needs it, and handed back with
+    the program: the more I/O, the less there is for O2 to do at compile time.
+*/
+
+typedef struct Writer
+{
+    const Gen *g;
+    unsigned rng;
+
+    char *out;
+    size_t len, cap;
+
+    size_t pos;                     // cell the pointer is on
+    size_t guard[GEN_MAX_DEPTH];    // counts of the nests around, not to be written
+    int depth;
+
+    unsigned char *tape;            // cells as they are after the last top level block
+    char *in;                       // input read so far
+    size_t in_len, in_cap;
+} Writer;
+
+static unsigned next(Writer *w)
+{
+    // xorshift, the same programs on every libc
+    w->rng ^= w->rng << 13;
+    w->rng ^= w->rng >> 17;
+    w->rng ^= w->rng << 5;
+    return w->rng;
+}
+
+// a number in [lo, hi]
+static size_t range(Writer *w, size_t lo, size_t hi)
+{
+    return lo + next(w) % (hi - lo + 1);
+}
+
+static void emit(Writer *w, char c, size_t n)
+{
+    while (w->len + n + 1 > w->cap)
+    {
+        w->cap *= 2;
+        w->out = realloc(w->out, w->cap);
+        if (!w->out)
+        {
+            fprintf(stderr, "Could not allocate memory for the program\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memset(w->out + w->len, c, n);
+    w->len += n;
+}
+
+static void move_to(Writer *w, size_t to)
+{
+    if (to > w->pos)
+        emit(w, '>', to - w->pos);
+    else
+        emit(w, '<', w->pos - to);
+    w->pos = to;
+}
+
+static bool guarded(Writer *w, size_t cell)
+{
+    for (int i = 0; i < w->depth; ++i)
+        if (w->guard[i] == cell)
+            return true;
+    return false;
+}
+
+// a cell that may be written
+static size_t pick(Writer *w)
+{
+    size_t cell;
+    do
+        cell = range(w, 0, w->g->span - 1);
+    while (guarded(w, cell));
+    return cell;
+}
+
+// Make up the next byte of input
+static unsigned char input(Writer *w)
+{
+    if (w->in_len == w->in_cap)
+    {
+        w->in_cap *= 2;
+        w->in = realloc(w->in, w->in_cap);
+        if (!w->in)
+        {
+            fprintf(stderr, "Could not allocate memory for the input\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return w->in[w->in_len++] = range(w, 1, 255);
+}
+
+// Run the code from start on the copy of the tape
+static void simulate(Writer *w, size_t start)
+{
+    size_t n = w->len - start, *match = malloc(sizeof(size_t) * (n + 1)), *stack = malloc(sizeof(size_t) * (n + 1));
+    size_t depth = 0, ptr = w->pos;
+    const char *code = w->out + start;
+
+    if (!match || !stack)
+    {
+        fprintf(stderr, "Could not allocate memory for the program\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (code[i] == '[')
+            stack[depth++] = i;
+        else if (code[i] == ']')
+        {
+            size_t j = stack[--depth];
+            match[i] = j;
+            match[j] = i;
+        }
+    }
+
+    // w->pos is where the pointer was before the block
+    for (size_t i = 0; i < n; ++i)
+    {
+        switch (code[i])
+        {
+            case '+': w->tape[ptr]++; break;
+            case '-': w->tape[ptr]--; break;
+            case '>': ptr++; break;
+            case '<': ptr--; break;
+            case ',': w->tape[ptr] = input(w); break;
+            case '[': if (!w->tape[ptr]) i = match[i]; break;
+            case ']': if (w->tape[ptr]) i = match[i]; break;
+            default: break;
+        }
+    }
+
+    free(match);
+    free(stack);
+    w->pos = ptr;
+}
+
+static void block(Writer *w, int level);
+
+static void arith(Writer *w)
+{
+    move_to(w, pick(w));
+    emit(w, range(w, 0, 1) ? '+' : '-', range(w, 1, 12));
+}
+
+static void clear(Writer *w)
+{
+    move_to(w, pick(w));
+    emit(w, '[', 1);
+    emit(w, range(w, 0, 3) ? '-' : '+', 1);
+    emit(w, ']', 1);
+}
+
+static void mul(Writer *w)
+{
+    size_t at = pick(w), targets = range(w, 1, 3);
+    bool first = range(w, 0, 1);
+
+    move_to(w, at);
+    emit(w, '[', 1);
+    if (first)
+        emit(w, '-', 1);
+
+    for (size_t k = 0; k < targets; ++k)
+    {
+        size_t to = pick(w);
+        if (to == at)
+            continue;
+        move_to(w, to);
+        emit(w, range(w, 0, 3) ? '+' : '-', range(w, 1, 5));
+    }
+
+    move_to(w, at);
+    if (!first)
+        emit(w, '-', 1);
+    emit(w, ']', 1);
+}
+
+static void io(Writer *w)
+{
+    if (range(w, 0, 1))
+    {
+        emit(w, '.', 1);
+        return;
+    }
+
+    move_to(w, pick(w));
+    emit(w, ',', 1);
+}
+
+static void scan(Writer *w)
+{
+    int dir = range(w, 0, 1) ? 1 : -1;
+    size_t stride = range(w, 1, 2);
+
+    // it has to stop on a 0 inside the span, the cell it starts on counts
+    for (long cell = w->pos; cell >= 0 && cell < (long)w->g->span; cell += dir * (long)stride)
+    {
+        if (w->tape[cell])
+            continue;
+
+        emit(w, '[', 1);
+        emit(w, dir > 0 ? '>' : '<', stride);
+        emit(w, ']', 1);
+        w->pos = cell;
+        return;
+    }
+}
+
+static void nest(Writer *w, int level)
+{
+    size_t count = pick(w), blocks = range(w, 1, 3);
+
+    move_to(w, count);
+    emit(w, '[', 1);
+    emit(w, '-', 1);
+    emit(w, ']', 1);
+    emit(w, '+', range(w, 2, 5));
+    emit(w, '[', 1);
+
+    w->guard[w->depth++] = count;
+    for (size_t k = 0; k < blocks; ++k)
+        block(w, level + 1);
+    w->depth--;
+
+    move_to(w, count);
+    emit(w, '-', 1);
+    emit(w, ']', 1);
+}
+
+// level is how many nests the block is in
+static void block(Writer *w, int level)
+{
+    const Gen *g = w->g;
+    // nests inside nests are likely, so a deep nest is more than a rare accident
+    int nests = level >= g->depth ? 0 : level ? 15 : 5, scans = level ? 0 : g->scan;
+    int total = 10 + g->mul + scans + g->clear + g->io + nests;
+    int roll = range(w, 0, total - 1);
+
+    if ((roll -= 10) < 0)
+    {
+        if (range(w, 0, 2))
+            arith(w);
+        else
+            move_to(w, range(w, 0, g->span - 1));
+    }
+    else if ((roll -= g->mul) < 0)
+        mul(w);
+    else if ((roll -= scans) < 0)
+        scan(w);
+    else if ((roll -= g->clear) < 0)
+        clear(w);
+    else if ((roll -= g->io) < 0)
+        io(w);
+    else
+        nest(w, level);
+}
+
+char *Generate(const Gen *g, char **in, size_t *n)
+{
+    Gen fixed = *g;
+    Writer w;
+
+    // room for the counts of the deepest nest and a cell to work on
+    fixed.depth = fixed.depth < 0 ? 0 : fixed.depth > GEN_MAX_DEPTH ? GEN_MAX_DEPTH : fixed.depth;
+    if (fixed.span < (size_t)fixed.depth + 2)
+        fixed.span = fixed.depth + 2;
+    if (fixed.span > TAPE_LEN)
+        fixed.span = TAPE_LEN;
+
+    w.g = &fixed;
+    w.rng = g->seed ? g->seed : 1;
+    w.cap = 64;
+    w.len = w.pos = 0;
+    w.depth = 0;
+    w.in_cap = 64;
+    w.in_len = 0;
+    w.out = malloc(w.cap);
+    w.in = malloc(w.in_cap);
+    w.tape = calloc(fixed.span, 1);
+    if (!w.out || !w.in || !w.tape)
+    {
+        fprintf(stderr, "Could not allocate memory for the program\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while (w.len < fixed.len)
+    {
+        size_t start = w.len, pos = w.pos;
+
+        block(&w, 0);
+
+        // a scan has already moved the pointer
+        w.pos = pos;
+        simulate(&w, start);
+    }
+
+    w.out[w.len] = '\0';
+    free(w.tape);
+    *in = w.in;
+    *n = w.in_len;
+    return w.out;
+}
+
+char *Expected(const char *p, const char *in, size_t in_len, size_t *n)
+{
+    List_t *tokens = Lexer(p, O0);
+    State_t *s = State_Cons(tokens);
+
+    Feed(s, in, in_len);
+    Close_Input(s);
+    while (Step(s, 1 << 20) != HALTED)
+        ;
+
+    char *out = malloc(s->out_len + 1);
+    if (!out)
+    {
+        fprintf(stderr, "Could not allocate memory for the output\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(out, s->out, s->out_len);
+    out[s->out_len] = '\0';
+    *n = s->out_len;
+
+    State_Destroy(s);
+    Destroy(tokens);
+    return out;
+}
@@ -0,0 +1,27 @@
+#ifndef __GEN_H
+#define __GEN_H
+
+#include <stddef.h>
+
+#define GEN_MAX_DEPTH 16    // deepest nest of counted loops
+
+// What a generated program looks like
+typedef struct Gen
+{
+    size_t len;     // characters of code, the program stops at the first block past it
+    int depth;      // deepest nest of counted loops, 0 for none
+    int mul, scan, clear, io;   // how often each kind of block comes up, against 10 for arithmetic and moves
+    size_t span;    // cells the program may touch, starting at cell 0
+    unsigned seed;
+} Gen;
+
+// Something like the example programs, a mix of everything
+#define GEN_DEFAULTS ((Gen){20000, 3, 10, 5, 10, 4, 64, 1})
+
+// Write a program that always halts without leaving the first span cells of the tape, and the input it reads
+// Both are malloc'd, the input is stored in in and its length in n
+char *Generate(const Gen *, char **in, size_t *n);
+// Run a program at O0 on an input, the output is malloc'd and its length stored
+char *Expected(const char *, const char *, size_t, size_t *);
+
+#endif
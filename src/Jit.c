@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "List.h"
+#include "Kernel.h"
+#include "Jit.h"
+
+/*
+    Machine code for hot loops (x86-64 only)
+
+    Compiling a whole program up front costs more than it saves on short runs, so the
+    interpreter only hands a loop to the JIT once it has been entered JIT_HOT times.
+    The loop is compiled on its own, nested loops included, and entered at its LOOP_START
+    with the interpreter's memory pointer and fuel. When it exits the interpreter carries on
+    from the ip it returns, which makes this on stack replacement for free: the interpreter's
+    whole state is the tape, the memory pointer and the ip.
+
+    Registers
+        rbx  memory pointer
+        r12  fuel
+        r13  the Regs the loop was entered with
+
+    Pointer moves are not emitted as they are read. The offset from rbx is tracked instead and
+    folded into the displacement of each access, rbx is only moved at loop boundaries.
+
+    Every back edge is charged the tokens of its loop's body. When the fuel runs out the code
+    exits with the ip of that loop's LOOP_START and zero fuel, so Step pauses right there.
+    Loops that do I/O are not compiled and keep running in the interpreter.
+*/
+
+#if defined(__x86_64__)
+
+// Code being emitted
+typedef struct Buf
+{
+    unsigned char *data;
+    size_t len, cap;
+} Buf;
+
+// A jump whose target isn't known yet
+typedef struct Patch
+{
+    size_t at;  // position of the rel32
+    size_t ip;  // ip to exit with
+} Patch;
+
+static void emit(Buf *b, const void *p, size_t n)
+{
+    if (b->len + n > b->cap)
+    {
+        while (b->len + n > b->cap)
+            b->cap = b->cap ? b->cap * 2 : 4096;
+        b->data = realloc(b->data, b->cap);
+
+        if (!b->data)
+        {
+            fprintf(stderr, "Could not reallocate memory for native code of capacity: %zu\n", b->cap);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+}
+
+#define EMIT(b, ...) do { unsigned char bytes_[] = {__VA_ARGS__}; emit(b, bytes_, sizeof(bytes_)); } while (0)
+
+static void emit32(Buf *b, int32_t x)
+{
+    emit(b, &x, 4);
+}
+
+static void emit64(Buf *b, uint64_t x)
+{
+    emit(b, &x, 8);
+}
+
+// Point the rel32 at position at to the current end of the code
+static void patch(Buf *b, size_t at)
+{
+    int32_t rel = b->len - (at + 4);
+    memcpy(b->data + at, &rel, 4);
+}
+
+// add rbx, by
+static void move(Buf *b, int by)
+{
+    if (!by)
+        return;
+    EMIT(b, 0x48, 0x81, 0xC3);
+    emit32(b, by);
+}
+
+// call through a kernel pointer, so the kernel picked at runtime is the one called
+static void call_kernel(Buf *b, void *kernel)
+{
+    EMIT(b, 0x48, 0xB8);
+    emit64(b, (uintptr_t)kernel);
+    EMIT(b, 0xFF, 0x10);
+}
+
+// Whether the loop starting at ip can be compiled
+static bool pure(List_t *tokens, size_t ip)
+{
+    for (size_t i = ip; i <= (size_t)tokens->data[ip]->offset; ++i)
+    {
+        switch (tokens->data[i]->flag)
+        {
+            case IN:
+            case OUT:
+            case PRINT_CONST:
+                return false;
+            default:
+                break;
+        }
+    }
+
+    return true;
+}
+
+Native *Jit_Compile(List_t *tokens, size_t ip)
+{
+    if (!pure(tokens, ip))
+        return NULL;
+
+    size_t end = tokens->data[ip]->offset;
+    Buf b = {NULL, 0, 0};
+
+    // bodies of the loops being compiled, and the je's at their starts
+    size_t *body = malloc(sizeof(size_t) * (end - ip + 1));
+    size_t *skip = malloc(sizeof(size_t) * (end - ip + 1));
+    Patch *stubs = malloc(sizeof(Patch) * (end - ip + 1));
+    size_t depth = 0, n_stubs = 0;
+    int at = 0;
+
+    if (!body || !skip || !stubs)
+    {
+        fprintf(stderr, "Could not allocate memory for the JIT\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // push rbx; push r12; push r13; mov r13, rdi; mov rbx, [r13]; mov r12, [r13 + 8]
+    EMIT(&b, 0x53, 0x41, 0x54, 0x41, 0x55, 0x49, 0x89, 0xFD, 0x49, 0x8B, 0x5D, 0x00, 0x4D, 0x8B, 0x65, 0x08);
+
+    for (size_t i = ip; i <= end; ++i)
+    {
+        Tok *t = tokens->data[i];
+
+        switch (t->flag)
+        {
+            case SUM:
+                // add byte [rbx + at], n
+                EMIT(&b, 0x80, 0x83);
+                emit32(&b, at);
+                EMIT(&b, (unsigned char)t->n);
+                break;
+            case SUB:
+                // sub byte [rbx + at], n
+                EMIT(&b, 0x80, 0xAB);
+                emit32(&b, at);
+                EMIT(&b, (unsigned char)t->n);
+                break;
+            case SHR:
+                at += t->n;
+                break;
+            case SHL:
+                at -= t->n;
+                break;
+            case MEM_SET:
+                // mov byte [rbx + at], n
+                EMIT(&b, 0xC6, 0x83);
+                emit32(&b, at);
+                EMIT(&b, (unsigned char)t->n);
+                break;
+            case MUL:
+                // movzx eax, byte [rbx + at]; test al, al; jz over
+                EMIT(&b, 0x0F, 0xB6, 0x83);
+                emit32(&b, at);
+                EMIT(&b, 0x84, 0xC0, 0x74, 12);
+                // imul eax, eax, n; add byte [rbx + at + offset], al
+                EMIT(&b, 0x69, 0xC0);
+                emit32(&b, t->n);
+                EMIT(&b, 0x00, 0x83);
+                emit32(&b, at + t->offset);
+                break;
+            case MEM_RANGE:
+                // Set_Range(rbx + at + offset, aux, n)
+                EMIT(&b, 0x48, 0x8D, 0xBB);
+                emit32(&b, at + t->offset);
+                EMIT(&b, 0xBE);
+                emit32(&b, t->aux);
+                EMIT(&b, 0xBA);
+                emit32(&b, t->n);
+                call_kernel(&b, &Set_Range);
+                break;
+            case MUL_VEC:
+                // movzx edx, byte [rbx + at]; test dl, dl; jz over
+                EMIT(&b, 0x0F, 0xB6, 0x93);
+                emit32(&b, at);
+                EMIT(&b, 0x84, 0xD2, 0x74, 34);
+                // Mul_Vec(rbx + at + offset, coef, dl, n)
+                EMIT(&b, 0x48, 0x8D, 0xBB);
+                emit32(&b, at + t->offset);
+                EMIT(&b, 0x48, 0xBE);
+                emit64(&b, (uintptr_t)(tokens->strs + t->aux));
+                EMIT(&b, 0xB9);
+                emit32(&b, t->n);
+                call_kernel(&b, &Mul_Vec);
+                break;
+            case COPY:
+                // movzx eax, byte [rbx + at]; test al, al; jz over; add byte [rbx + at + offset], al
+                EMIT(&b, 0x0F, 0xB6, 0x83);
+                emit32(&b, at);
+                EMIT(&b, 0x84, 0xC0, 0x74, 6, 0x00, 0x83);
+                emit32(&b, at + t->offset);
+                // movzx eax, byte [rbx + at + aux]; add byte [rbx + at], al; mov byte [rbx + at + aux], 0
+                EMIT(&b, 0x0F, 0xB6, 0x83);
+                emit32(&b, at + t->aux);
+                EMIT(&b, 0x00, 0x83);
+                emit32(&b, at);
+                EMIT(&b, 0xC6, 0x83);
+                emit32(&b, at + t->aux);
+                EMIT(&b, 0x00);
+                break;
+            case CMP:
+                // movzx eax, byte [rbx + at]; cmp al, byte [rbx + at + offset]; sete/ setne al
+                EMIT(&b, 0x0F, 0xB6, 0x83);
+                emit32(&b, at);
+                EMIT(&b, 0x3A, 0x83);
+                emit32(&b, at + t->offset);
+                EMIT(&b, 0x0F, t->n ? 0x94 : 0x95, 0xC0);
+                // mov byte [rbx + at], al; mov byte [rbx + at + offset], 0
+                EMIT(&b, 0x88, 0x83);
+                emit32(&b, at);
+                EMIT(&b, 0xC6, 0x83);
+                emit32(&b, at + t->offset);
+                EMIT(&b, 0x00);
+                break;
+            case DIVMOD:
+                // Divmod(rbx + at)
+                EMIT(&b, 0x48, 0x8D, 0xBB);
+                emit32(&b, at);
+                EMIT(&b, 0x48, 0xB8);
+                emit64(&b, (uintptr_t)&Divmod);
+                EMIT(&b, 0xFF, 0xD0);
+                break;
+            case IF:
+                move(&b, at);
+                at = 0;
+
+                // cmp byte [rbx], 0; je past the END_IF
+                EMIT(&b, 0x80, 0x3B, 0x00, 0x0F, 0x84);
+                skip[depth++] = b.len;
+                emit32(&b, 0);
+                break;
+            case END_IF:
+                // both ways in have to agree on rbx
+                move(&b, at);
+                at = 0;
+                patch(&b, skip[--depth]);
+                break;
+            case LOOP_START:
+                move(&b, at);
+                at = 0;
+
+                // cmp byte [rbx], 0; je past the loop
+                EMIT(&b, 0x80, 0x3B, 0x00, 0x0F, 0x84);
+                skip[depth] = b.len;
+                emit32(&b, 0);
+                body[depth++] = b.len;
+                break;
+            case LOOP_END:
+                move(&b, at);
+                at = 0;
+                depth--;
+
+                // cmp byte [rbx], 0; je past the loop
+                EMIT(&b, 0x80, 0x3B, 0x00, 0x0F, 0x84);
+                size_t done = b.len;
+                emit32(&b, 0);
+
+                // cmp r12, cost; jb out of fuel; sub r12, cost
+                EMIT(&b, 0x49, 0x81, 0xFC);
+                emit32(&b, i - t->offset + 1);
+                EMIT(&b, 0x0F, 0x82);
+                stubs[n_stubs++] = (Patch){b.len, t->offset};
+                emit32(&b, 0);
+                EMIT(&b, 0x49, 0x81, 0xEC);
+                emit32(&b, i - t->offset + 1);
+
+                // jmp back to the body
+                EMIT(&b, 0xE9);
+                emit32(&b, body[depth] - (b.len + 4));
+
+                patch(&b, done);
+                patch(&b, skip[depth]);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // carry on after the loop
+    EMIT(&b, 0xB8);
+    emit32(&b, end + 1);
+    size_t out = b.len;
+    // mov [r13], rbx; mov [r13 + 8], r12; pop r13; pop r12; pop rbx; ret
+    EMIT(&b, 0x49, 0x89, 0x5D, 0x00, 0x4D, 0x89, 0x65, 0x08, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3);
+
+    // out of fuel: xor r12d, r12d; mov eax, ip; jmp exit
+    for (size_t k = 0; k < n_stubs; ++k)
+    {
+        patch(&b, stubs[k].at);
+        EMIT(&b, 0x45, 0x31, 0xE4, 0xB8);
+        emit32(&b, stubs[k].ip);
+        EMIT(&b, 0xE9);
+        emit32(&b, out - (b.len + 4));
+    }
+
+    free(body);
+    free(skip);
+    free(stubs);
+
+    // map the code writable, then swap to executable
+    Native *nat = malloc(sizeof(Native));
+    void *code = mmap(NULL, b.len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (!nat || code == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not allocate memory for native code\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(code, b.data, b.len);
+    free(b.data);
+
+    if (mprotect(code, b.len, PROT_READ | PROT_EXEC))
+    {
+        munmap(code, b.len);
+        free(nat);
+        return NULL;
+    }
+
+    nat->code = (size_t (*)(Regs *))code;
+    nat->size = b.len;
+    return nat;
+}
+
+#else
+
+Native *Jit_Compile(List_t *tokens, size_t ip)
+{
+    (void)tokens;
+    (void)ip;
+    return NULL;
+}
+
+#endif
+
+size_t Run_Native(Native *nat, Regs *r)
+{
+    return nat->code(r);
+}
+
+void Native_Destroy(Native *nat)
+{
+    munmap((void *)nat->code, nat->size);
+    free(nat);
+}
@@ -0,0 +1,31 @@
+#ifndef __JIT_H
+#define __JIT_H
+
+#include <stddef.h>
+#include "List.h"
+
+// Number of times a loop is entered before it is compiled to machine code
+#define JIT_HOT 1024
+
+// Registers of a native loop, loaded on entry and written back on exit
+typedef struct Regs
+{
+    char *ptr;
+    size_t fuel;
+} Regs;
+
+// A loop compiled to machine code
+typedef struct Native
+{
+    size_t (*code)(Regs *); // returns the ip to carry on from
+    size_t size;            // bytes mapped for the code
+} Native;
+
+// Compile the loop starting at ip, NULL if it does I/O or the machine isn't supported
+Native *Jit_Compile(List_t *, size_t);
+// Run a native loop until it exits or runs out of fuel, returns the ip to carry on from
+size_t Run_Native(Native *, Regs *);
+// Destructor
+void Native_Destroy(Native *);
+
+#endif
@@ -0,0 +1,184 @@
+#include "Kernel.h"
+
+#if defined(__x86_64__) // SSE2 is part of the x86-64 baseline
+#include <immintrin.h>
+#define HAVE_X86 1
+#else
+#define HAVE_X86 0
+#endif
+
+/*
+    Cells are bytes, so a vector of 16 (SSE2) or 32 (AVX2) cells is handled per instruction.
+    There is no 8 bit multiply, so Mul_Vec widens the coefficients to 16 bits, multiplies,
+    and packs the low bytes of the products back down, which is the product mod 256.
+    The tail of a window that doesn't fill a vector is done one cell at a time.
+*/
+
+static void set_range_scalar(char *dst, unsigned char v, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = v;
+}
+
+static void mul_vec_scalar(char *dst, const unsigned char *coef, unsigned char src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        dst[i] += src * coef[i];
+}
+
+#if HAVE_X86
+static void set_range_sse2(char *dst, unsigned char v, size_t n)
+{
+    __m128i x = _mm_set1_epi8(v);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16)
+        _mm_storeu_si128((__m128i *)(dst + i), x);
+
+    set_range_scalar(dst + i, v, n - i);
+}
+
+static void mul_vec_sse2(char *dst, const unsigned char *coef, unsigned char src, size_t n)
+{
+    __m128i s = _mm_set1_epi16(src);
+    __m128i low = _mm_set1_epi16(0xff);
+    __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i *)(coef + i));
+        __m128i lo = _mm_and_si128(_mm_mullo_epi16(_mm_unpacklo_epi8(c, zero), s), low);
+        __m128i hi = _mm_and_si128(_mm_mullo_epi16(_mm_unpackhi_epi8(c, zero), s), low);
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi8(d, _mm_packus_epi16(lo, hi)));
+    }
+
+    mul_vec_scalar(dst + i, coef + i, src, n - i);
+}
+
+__attribute__((target("avx2")))
+static void set_range_avx2(char *dst, unsigned char v, size_t n)
+{
+    __m256i x = _mm256_set1_epi8(v);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32)
+        _mm256_storeu_si256((__m256i *)(dst + i), x);
+
+    set_range_sse2(dst + i, v, n - i);
+}
+
+// unpack and pack both work within 128 bit lanes, so the bytes come back out in order
+__attribute__((target("avx2")))
+static void mul_vec_avx2(char *dst, const unsigned char *coef, unsigned char src, size_t n)
+{
+    __m256i s = _mm256_set1_epi16(src);
+    __m256i low = _mm256_set1_epi16(0xff);
+    __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i c = _mm256_loadu_si256((const __m256i *)(coef + i));
+        __m256i lo = _mm256_and_si256(_mm256_mullo_epi16(_mm256_unpacklo_epi8(c, zero), s), low);
+        __m256i hi = _mm256_and_si256(_mm256_mullo_epi16(_mm256_unpackhi_epi8(c, zero), s), low);
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_add_epi8(d, _mm256_packus_epi16(lo, hi)));
+    }
+
+    mul_vec_sse2(dst + i, coef + i, src, n - i);
+}
+#endif
+
+// The first call to a kernel picks the best ones and then goes through
+static void set_range_first(char *dst, unsigned char v, size_t n)
+{
+    Kernel_Select(Kernel_Best());
+    Set_Range(dst, v, n);
+}
+
+static void mul_vec_first(char *dst, const unsigned char *coef, unsigned char src, size_t n)
+{
+    Kernel_Select(Kernel_Best());
+    Mul_Vec(dst, coef, src, n);
+}
+
+void (*Set_Range)(char *, unsigned char, size_t) = set_range_first;
+void (*Mul_Vec)(char *, const unsigned char *, unsigned char, size_t) = mul_vec_first;
+
+bool Kernel_Select(Kernel k)
+{
+#if HAVE_X86
+    __builtin_cpu_init();
+#endif
+
+    switch (k)
+    {
+        case KERNEL_SCALAR:
+            Set_Range = set_range_scalar;
+            Mul_Vec = mul_vec_scalar;
+            return true;
+#if HAVE_X86
+        case KERNEL_SSE2:
+            if (!__builtin_cpu_supports("sse2"))
+                return false;
+            Set_Range = set_range_sse2;
+            Mul_Vec = mul_vec_sse2;
+            return true;
+        case KERNEL_AVX2:
+            if (!__builtin_cpu_supports("avx2"))
+                return false;
+            Set_Range = set_range_avx2;
+            Mul_Vec = mul_vec_avx2;
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+Kernel Kernel_Best(void)
+{
+#if HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return KERNEL_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return KERNEL_SSE2;
+#endif
+    return KERNEL_SCALAR;
+}
+
+const char *Kernel_Name(Kernel k)
+{
+    const char *names[KERNEL_COUNT] = {"scalar", "sse2", "avx2"};
+    return k < KERNEL_COUNT ? names[k] : "unknown";
+}
+
+/*
+    The divmod idiom, with n in the current cell and d two cells to the right
+
+        [->+>-[>+>>]>[+[-<+>]>+>>]<<<<<<]      n 0 d 0 0 0 0   =>   0 n d-n%d n%d n/d 0 0
+
+    It only gives that result if the cells it uses as scratch start out as 0 and d isn't 1,
+    so those are checked first. If they don't hold nothing is touched and the loop after the
+    DIVMOD token does the work, if they do the current cell ends up 0 and the loop is skipped.
+    A d of 0 counts down from 256, so it acts like 256. The cells 1 and 4 right of n are only
+    ever added to, so they don't have to start out as 0.
+*/
+void Divmod(char *ptr)
+{
+    unsigned char n = ptr[0], d = ptr[2];
+    if (!n || d == 1 || ptr[3] || ptr[5] || ptr[6])
+        return;
+
+    unsigned D = d ? d : 256;
+    ptr[0] = 0;
+    ptr[1] += n;
+    ptr[2] = D - n % D;
+    ptr[3] = n % D;
+    ptr[4] += n / D;
+}
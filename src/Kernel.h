@@ -0,0 +1,37 @@
+#ifndef __KERNEL_H
+#define __KERNEL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+    Kernels behind the vector tokens
+
+    Each kernel has a scalar, an SSE2 and an AVX2 version. The best one the CPU
+    supports is picked the first time a kernel is called, or by Kernel_Select.
+*/
+
+typedef enum Kernel
+{
+    KERNEL_SCALAR,
+    KERNEL_SSE2,
+    KERNEL_AVX2,
+    KERNEL_COUNT,
+} Kernel;
+
+// Set n cells to v
+extern void (*Set_Range)(char *, unsigned char, size_t);
+// Add src * coef[k] to the k'th of n cells
+extern void (*Mul_Vec)(char *, const unsigned char *, unsigned char, size_t);
+
+// Run the DIVMOD idiom on the cells starting at the pointer, if its preconditions hold
+void Divmod(char *);
+
+// Use a set of kernels, false if the CPU does not support them
+bool Kernel_Select(Kernel);
+// Best set of kernels the CPU supports
+Kernel Kernel_Best(void);
+// Name of a set of kernels
+const char *Kernel_Name(Kernel);
+
+#endif
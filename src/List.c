@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "Token.h"
 #include "List.h"
 
@@ -23,6 +24,9 @@ List_t *Cons(size_t c0)
     xs->cap = c0;
     xs->len = 0;
 
+    xs->strs = NULL;
+    xs->strs_len = xs->strs_cap = 0;
+
     return xs;
 }
 
@@ -45,6 +49,43 @@ void Append(List_t *xs, Tok *e)
     xs->data[xs->len++] = e;
 }
 
+// Append bytes to the string table
+size_t Append_Str(List_t *xs, const char *s, size_t n)
+{
+    if (xs->strs_len + n > xs->strs_cap)
+    {
+        if (!xs->strs_cap)
+            xs->strs_cap = 64;
+        while (xs->strs_len + n > xs->strs_cap)
+            xs->strs_cap *= R;
+        xs->strs = realloc(xs->strs, xs->strs_cap);
+
+        if (!xs->strs)
+        {
+            fprintf(stderr, "Could not reallocate memory for the string table of capacity: %zu\n", xs->strs_cap);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    size_t at = xs->strs_len;
+    memcpy(xs->strs + at, s, n);
+    xs->strs_len += n;
+
+    return at;
+}
+
+// Hand the string table of src over to dst
+void Take_Strs(List_t *dst, List_t *src)
+{
+    free(dst->strs);
+    dst->strs = src->strs;
+    dst->strs_len = src->strs_len;
+    dst->strs_cap = src->strs_cap;
+
+    src->strs = NULL;
+    src->strs_len = src->strs_cap = 0;
+}
+
 // Destructor
 void Destroy(List_t *xs)
 {
@@ -52,5 +93,6 @@ void Destroy(List_t *xs)
     for (size_t i = 0; i < len(xs); ++i)
         free(xs->data[i]);
     free(xs->data);
+    free(xs->strs);
     free(xs);
 }
@@ -11,6 +11,10 @@ typedef struct List_t
 {
     size_t cap, len;
     Tok **data;
+
+    // string table for tokens that carry constant data, such as PRINT_CONST
+    char *strs;
+    size_t strs_len, strs_cap;
 } List_t;
 
 // Constructor
@@ -19,6 +23,10 @@ List_t *Cons(size_t);
 void Destroy(List_t *);
 // Append to the end of the list
 void Append(List_t *, Tok *);
+// Append bytes to the string table, returns their offset in the table
+size_t Append_Str(List_t *, const char *, size_t);
+// Hand the string table of one list over to another
+void Take_Strs(List_t *, List_t *);
 // Get len of list
 inline size_t len(List_t *xs) { return xs->len; }
 // Get last element of list
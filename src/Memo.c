@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "List.h"
+#include "Memo.h"
+#include "nerv.h"
+
+/*
+    Memoization of pure loops
+
+    A loop that does no I/O and leaves the pointer where it found it only ever touches a
+    fixed window of cells around the loop cell, so what it leaves in that window depends on
+    nothing but what was in the window when it started. Programs that print numbers run the
+    same divmod loops on the same few cells over and over, so with --memo the window is saved
+    on entry and, once the loop exits, stored with the window it left behind:
+
+        entry    window hashed with the loop's ip, on a hit the cached window is copied in
+                 and the loop is skipped, on a miss the window is kept while the loop runs
+        exit     the kept window and the window now on the tape go into the cache
+
+    Loops being recorded sit on a stack since they can nest. A loop already on top of the
+    stack is being re-entered by its own back edge, so it isn't looked up again.
+
+    The cache is direct mapped, a new entry replaces whatever was in its slot.
+*/
+
+// What a loop may touch, worked out the first time it is entered
+typedef struct Window
+{
+    bool done, pure;
+    int lo;     // first cell, relative to the loop cell
+    size_t n;   // number of cells
+} Window;
+
+typedef struct Entry
+{
+    size_t ip;  // LOOP_START of the loop
+    size_t n;   // 0 for an empty slot
+    char before[MEMO_SPAN], after[MEMO_SPAN];
+} Entry;
+
+typedef struct Record
+{
+    size_t ip, end;
+    char *at;   // first cell of the window
+    Window *w;
+    char before[MEMO_SPAN];
+} Record;
+
+typedef struct Memo
+{
+    Window *windows;    // indexed by LOOP_START
+    Entry *cache;
+    Record stack[MEMO_DEPTH];
+    size_t depth;
+    size_t hits, misses, stored;
+} Memo;
+
+void Memo_Enable(State_t *s)
+{
+    Memo *m = malloc(sizeof(Memo));
+    if (!m)
+    {
+        fprintf(stderr, "Could not allocate memory for the memo cache\n");
+        exit(EXIT_FAILURE);
+    }
+
+    m->windows = calloc(len(s->tokens), sizeof(Window));
+    m->cache = calloc(MEMO_CAP, sizeof(Entry));
+    if (!m->windows || !m->cache)
+    {
+        fprintf(stderr, "Could not allocate memory for the memo cache\n");
+        exit(EXIT_FAILURE);
+    }
+
+    m->depth = 0;
+    m->hits = m->misses = m->stored = 0;
+    s->memo = m;
+}
+
+// Work out the window of the loop starting at ip
+static void window(List_t *tokens, size_t ip, Window *w)
+{
+    size_t end = tokens->data[ip]->offset;
+    long pos = 0, lo = 0, hi = 0;
+
+    w->done = true;
+    w->pure = end - ip + 1 >= MEMO_MIN && balanced(tokens, ip);
+
+    // nested loops are balanced too, so walking straight through them keeps the position right
+    for (size_t i = ip + 1; i < end && w->pure; ++i)
+    {
+        Tok *t = tokens->data[i];
+        long first = pos, last = pos;
+
+        switch (t->flag)
+        {
+            case SHR:
+                pos += t->n;
+                break;
+            case SHL:
+                pos -= t->n;
+                break;
+            case MUL:
+                first = last = pos + t->offset;
+                break;
+            case MEM_RANGE:
+            case MUL_VEC:
+                first = pos + t->offset;
+                last = first + t->n - 1;
+                break;
+            case COPY:
+                first = pos + (t->offset < t->aux ? t->offset : t->aux);
+                last = pos + (t->offset > t->aux ? t->offset : t->aux);
+                break;
+            case CMP:
+                first = last = pos + t->offset;
+                break;
+            case DIVMOD:
+                last = pos + 6;
+                break;
+            case IN:
+            case OUT:
+            case PRINT_CONST:
+                w->pure = false;
+                break;
+            default:
+                break;
+        }
+
+        lo = first < lo ? first : lo;
+        lo = pos < lo ? pos : lo;
+        hi = last > hi ? last : hi;
+        hi = pos > hi ? pos : hi;
+    }
+
+    w->lo = lo;
+    w->n = hi - lo + 1;
+    w->pure = w->pure && w->n <= MEMO_SPAN;
+}
+
+static Entry *slot(Memo *m, size_t ip, const char *cells, size_t n)
+{
+    uint64_t h = Hash(cells, n) ^ (ip * 1099511628211ULL);
+    return &m->cache[h % MEMO_CAP];
+}
+
+bool Memo_Enter(State_t *s, size_t ip, char *ptr)
+{
+    Memo *m = s->memo;
+    size_t end = s->tokens->data[ip]->offset;
+
+    // a back edge of the loop being recorded, or no room to record another one
+    if ((m->depth && m->stack[m->depth - 1].end == end) || m->depth == MEMO_DEPTH)
+        return false;
+
+    Window *w = &m->windows[ip];
+    if (!w->done)
+        window(s->tokens, ip, w);
+    if (!w->pure)
+        return false;
+
+    // the cells the body may touch hang off an end of the tape, leave it to the interpreter
+    char *at = ptr + w->lo;
+    if (at < s->mem || at + w->n > s->mem + TAPE_LEN)
+        return false;
+
+    Entry *e = slot(m, ip, at, w->n);
+
+    if (e->ip == ip && e->n == w->n && !memcmp(e->before, at, w->n))
+    {
+        memcpy(at, e->after, w->n);
+        m->hits++;
+        return true;
+    }
+
+    Record *r = &m->stack[m->depth++];
+    r->ip = ip;
+    r->end = end;
+    r->at = at;
+    r->w = w;
+    memcpy(r->before, at, w->n);
+    m->misses++;
+
+    return false;
+}
+
+// the loop is balanced, so its window is where it was on entry
+void Memo_Exit(State_t *s, size_t end)
+{
+    Memo *m = s->memo;
+
+    if (!m->depth || m->stack[m->depth - 1].end != end)
+        return;
+
+    Record *r = &m->stack[--m->depth];
+    Entry *e = slot(m, r->ip, r->before, r->w->n);
+
+    e->ip = r->ip;
+    e->n = r->w->n;
+    memcpy(e->before, r->before, r->w->n);
+    memcpy(e->after, r->at, r->w->n);
+    m->stored++;
+}
+
+void Memo_Stats(State_t *s, FILE *fp)
+{
+    Memo *m = s->memo;
+    size_t total = m->hits + m->misses;
+
+    fprintf(fp, "memo: %zu hits, %zu misses (%.2f%% hit rate), %zu results stored\n",
+            m->hits, m->misses, total ? 100.0 * m->hits / total : 0.0, m->stored);
+}
+
+void Memo_Destroy(State_t *s)
+{
+    Memo *m = s->memo;
+    if (!m)
+        return;
+
+    free(m->windows);
+    free(m->cache);
+    free(m);
+    s->memo = NULL;
+}
@@ -0,0 +1,24 @@
+#ifndef __MEMO_H
+#define __MEMO_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "State.h"
+
+#define MEMO_SPAN 32    // widest window of cells a memoized loop may touch
+#define MEMO_MIN 8      // fewest tokens in a loop worth memoizing
+#define MEMO_CAP 4096   // entries in the cache
+#define MEMO_DEPTH 64   // most loops recorded at once
+
+// Turn on memoization of pure loops for a state
+void Memo_Enable(State_t *);
+// Look up a loop on entry (the cell is nonzero), true if it was skipped with the cached result
+bool Memo_Enter(State_t *, size_t, char *);
+// Store the result of the loop ending at ip, if it is being recorded
+void Memo_Exit(State_t *, size_t);
+// Print hit/ miss statistics
+void Memo_Stats(State_t *, FILE *);
+// Destructor
+void Memo_Destroy(State_t *);
+
+#endif
@@ -0,0 +1,1093 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include "List.h"
+#include "Token.h"
+#include "nerv.h"
+#include "Profile.h"
+#include "Report.h"
+
+/*
+    Optimization passes that run after the Optimizer at O2
+
+    Each pass takes a list of tokens with computed loop offsets and returns a new one,
+    the original list is freed.
+*/
+
+// Constants
+#define SPAN (2 * TAPE_LEN)    // number of cells the constant propagator tracks
+#define UNROLL_MAX 1024        // most tokens a single unrolled loop may expand to
+#define UNROLL_ITERS 256       // most iterations of a loop that will be unrolled
+#define PROP_FUEL (1 << 22)    // most tokens the constant propagator will visit
+#define RANGE_MIN 4            // fewest MEM_SETs merged into a MEM_RANGE
+#define VEC_MIN 3              // fewest MULs merged into a MUL_VEC
+#define VEC_SPAN 64            // widest window of a MUL_VEC
+
+// Append a new token to a list
+static Tok *push(List_t *out, Type flag, int n, int offset)
+{
+    Tok *t = malloc(sizeof(Tok));
+    if (!t)
+    {
+        fprintf(stderr, "Could not allocate memory for a token\n");
+        exit(EXIT_FAILURE);
+    }
+
+    t->flag = flag;
+    t->n = n;
+    t->offset = offset;
+    t->aux = 0;
+
+    Append(out, t);
+    return t;
+}
+
+// Drop tokens from the end of a list
+static void drop(List_t *out, size_t n)
+{
+    while (len(out) > n)
+        free(out->data[--out->len]);
+}
+
+// Append a pointer move, merged into the last token if that one is a move too
+// tokens below floor are left alone
+static void shift(List_t *out, size_t floor, int by)
+{
+    if (len(out) > floor && (tail(out)->flag == SHR || tail(out)->flag == SHL))
+    {
+        by += tail(out)->flag == SHR ? tail(out)->n : -tail(out)->n;
+        free(out->data[--out->len]);
+    }
+
+    if (by > 0)
+        push(out, SHR, by, 0);
+    else if (by < 0)
+        push(out, SHL, -by, 0);
+}
+
+// Whether a loop's body leaves the memory pointer where it found it, including any nested loops
+bool balanced(List_t *tokens, size_t start)
+{
+    size_t end = tokens->data[start]->offset;
+    long position = 0;
+
+    for (size_t i = start + 1; i < end; ++i)
+    {
+        Tok *t = tokens->data[i];
+
+        switch (t->flag)
+        {
+            case SHR:
+                position += t->n;
+                break;
+            case SHL:
+                position -= t->n;
+                break;
+            case LOOP_START:
+                if (!balanced(tokens, i))
+                    return false;
+                i = t->offset;
+                break;
+            default:
+                break;
+        }
+    }
+
+    return position == 0;
+}
+
+// Constant propagation
+/*
+    The tape starts out zeroed, so the value of a cell is often known at compile time.
+    The propagator walks the program once, keeping track of which cells hold known values
+    and where the memory pointer is, and rewrites the program with what it learns:
+
+        +++[-]++       =>   MEM_SET(2)          SUM/ SUB on a known cell become a MEM_SET
+        [-]+[-]        =>   (nothing)           at the start of a program the cell is already 0
+        [-][->+<]      =>   MEM_SET(0)          loops entered on a provably zero cell are removed
+        +++[>++<-]     =>   >++>++>++<...       loops with a known trip count are unrolled
+        +++++++[>+++++++<-]>.+.   =>   PRINT_CONST("12")   output of known cells is folded into strings
+
+    Loops that can't be resolved are kept. If the body of the loop leaves the memory pointer
+    where it found it, only the cells written inside the loop are forgotten, otherwise
+    everything is, and tracking carries on relative to the pointer on the loop's exit.
+    Either way the loop cell is known to be 0 once the loop exits.
+
+    Runs of output with known values are collected in the output list's string table and
+    written by a single PRINT_CONST, which is flushed before anything the output has to stay
+    ordered with: an unknown OUT, an IN, or a loop boundary.
+
+    Unrolling is speculative: the loop is expanded one iteration at a time and, if the trip
+    count turns out not to be known or the expansion gets too big, the emitted tokens and
+    the tracked values are rolled back using an undo log. Loops a profile in use says never
+    ran aren't unrolled, see Profile.h.
+*/
+
+// An entry in the undo log
+typedef struct Undo
+{
+    long cell;
+    unsigned gen;
+    unsigned char val;
+} Undo;
+
+typedef struct Prop
+{
+    List_t *in, *out;
+
+    // a cell is known if its stamp is the current generation, so everything can be forgotten at once
+    unsigned char *val;
+    unsigned *gen;
+    unsigned cur;
+    long pos; // memory pointer
+
+    // undo log, only written while unrolling
+    Undo *log;
+    size_t log_len, log_cap;
+    int depth;  // number of unroll attempts in progress
+
+    size_t floor; // tokens below this index are not rewritten in place
+    size_t pend;  // start of the output run in out->strs not yet written by a PRINT_CONST
+    long fuel;
+} Prop;
+
+static bool known(Prop *p, long cell)
+{
+    return cell >= 0 && cell < SPAN && p->gen[cell] == p->cur;
+}
+
+// Record a cell before it changes, so an unroll attempt can be undone
+static void remember(Prop *p, long cell)
+{
+    if (!p->depth)
+        return;
+
+    if (p->log_len == p->log_cap)
+    {
+        p->log_cap = p->log_cap ? p->log_cap * 2 : 256;
+        p->log = realloc(p->log, sizeof(Undo) * p->log_cap);
+
+        if (!p->log)
+        {
+            fprintf(stderr, "Could not reallocate memory for the undo log of capacity: %zu\n", p->log_cap);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    p->log[p->log_len++] = (Undo){cell, p->gen[cell], p->val[cell]};
+}
+
+static void set(Prop *p, long cell, unsigned char v)
+{
+    if (cell < 0 || cell >= SPAN)
+        return;
+
+    remember(p, cell);
+    p->val[cell] = v;
+    p->gen[cell] = p->cur;
+}
+
+static void forget(Prop *p, long cell)
+{
+    if (!known(p, cell))
+        return;
+
+    remember(p, cell);
+    p->gen[cell] = 0;
+}
+
+// Forget every cell, tracking continues relative to the memory pointer
+static void forget_all(Prop *p)
+{
+    p->cur++;
+    p->pos = SPAN / 2;
+}
+
+// Forget the cells a balanced loop writes to
+static void forget_writes(Prop *p, size_t start)
+{
+    size_t end = p->in->data[start]->offset;
+    long cell = p->pos;
+
+    for (size_t i = start + 1; i < end; ++i)
+    {
+        Tok *t = p->in->data[i];
+
+        switch (t->flag)
+        {
+            case SHR:
+                cell += t->n;
+                break;
+            case SHL:
+                cell -= t->n;
+                break;
+            case SUM:
+            case SUB:
+            case MEM_SET:
+            case IN:
+                forget(p, cell);
+                break;
+            case MUL:
+                forget(p, cell + t->offset);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Emit a MEM_SET, merged into the previous token if that one is a MEM_SET too
+static void emit_set(Prop *p, unsigned char v)
+{
+    List_t *out = p->out;
+
+    if (len(out) > p->floor && tail(out)->flag == MEM_SET)
+        tail(out)->n = v;
+    else
+        push(out, MEM_SET, v, 0);
+}
+
+// Emit a pointer move, merged into the previous token if that one is a move too
+static void emit_shift(Prop *p, int by)
+{
+    shift(p->out, p->floor, by);
+}
+
+// Emit a PRINT_CONST for the pending run of known output
+static void flush_out(Prop *p)
+{
+    List_t *out = p->out;
+
+    if (out->strs_len > p->pend)
+        push(out, PRINT_CONST, out->strs_len - p->pend, p->pend);
+    p->pend = out->strs_len;
+}
+
+static void prop(Prop *, size_t, size_t);
+
+// Try to expand a loop entered on a known nonzero cell into straight line code
+static bool unroll(Prop *p, size_t start)
+{
+    size_t end = p->in->data[start]->offset;
+
+    // save everything needed to roll back
+    size_t mark = len(p->out), log_mark = p->log_len, floor = p->floor;
+    size_t strs_mark = p->out->strs_len, pend = p->pend;
+    unsigned cur = p->cur;
+    long pos = p->pos;
+
+    p->depth++;
+    p->floor = mark;
+
+    bool done = false;
+    for (int iter = 0; iter < UNROLL_ITERS && p->fuel > 0 && len(p->out) - mark <= UNROLL_MAX; ++iter)
+    {
+        prop(p, start + 1, end);
+
+        // the trip count is not known after all
+        if (!known(p, p->pos))
+            break;
+
+        if (!p->val[p->pos])
+        {
+            done = true;
+            break;
+        }
+    }
+
+    done = done && len(p->out) - mark <= UNROLL_MAX;
+
+    if (!done)
+    {
+        drop(p->out, mark);
+        p->out->strs_len = strs_mark;
+        p->pend = pend;
+        while (p->log_len > log_mark)
+        {
+            Undo *u = &p->log[--p->log_len];
+            p->gen[u->cell] = u->gen;
+            p->val[u->cell] = u->val;
+        }
+        p->cur = cur;
+        p->pos = pos;
+    }
+
+    p->depth--;
+    p->floor = floor;
+    if (!p->depth)
+        p->log_len = 0;
+
+    return done;
+}
+
+// Propagate through the tokens in [lo, hi)
+static void prop(Prop *p, size_t lo, size_t hi)
+{
+    for (size_t i = lo; i < hi; ++i)
+    {
+        Tok *t = p->in->data[i];
+        long at = p->pos;
+        p->fuel--;
+
+        switch (t->flag)
+        {
+            case SUM:
+            case SUB:
+                if (known(p, at))
+                {
+                    unsigned char v = p->val[at] + (t->flag == SUM ? t->n : -t->n);
+                    set(p, at, v);
+                    emit_set(p, v);
+                }
+                else
+                    push(p->out, t->flag, t->n, t->offset);
+                break;
+            case MEM_SET:
+                // the cell already holds the value
+                if (known(p, at) && p->val[at] == (unsigned char)t->n)
+                    break;
+                set(p, at, t->n);
+                emit_set(p, t->n);
+                break;
+            case SHR:
+                p->pos += t->n;
+                emit_shift(p, t->n);
+                break;
+            case SHL:
+                p->pos -= t->n;
+                emit_shift(p, -t->n);
+                break;
+            case IN:
+                flush_out(p);
+                forget(p, at);
+                push(p->out, IN, t->n, t->offset);
+                break;
+            case OUT:
+                if (known(p, at))
+                {
+                    char c = p->val[at];
+                    Append_Str(p->out, &c, 1);
+                    break;
+                }
+                flush_out(p);
+                push(p->out, OUT, t->n, t->offset);
+                break;
+            case MUL:
+                if (known(p, at) && !p->val[at])
+                    break;
+                if (known(p, at) && known(p, at + t->offset))
+                    set(p, at + t->offset, p->val[at + t->offset] + p->val[at] * t->n);
+                else
+                    forget(p, at + t->offset);
+                push(p->out, MUL, t->n, t->offset);
+                break;
+            case LOOP_START:
+                // never entered
+                if (known(p, at) && !p->val[at])
+                {
+                    if (!p->depth)
+                        Report_Loop(p->in, i, "removed by Const_Prop, its cell is known to be 0");
+                    i = t->offset;
+                    break;
+                }
+
+                // a loop the profile never saw run isn't worth the code it unrolls to
+                if (known(p, at))
+                {
+                    const char *why = "its trip count isn't known or it unrolls too far";
+                    if (p->fuel <= 0)
+                        why = "out of fuel";
+                    else if (Profile_Cold(t->aux))
+                        why = "the profile never saw it run";
+                    else if (unroll(p, i))
+                        why = NULL;
+
+                    // loops inside one being unrolled are reported with it
+                    if (!p->depth && why)
+                        Report_Loop(p->in, i, "kept by Const_Prop, %s", why);
+                    else if (!p->depth)
+                        Report_Loop(p->in, i, "unrolled by Const_Prop, its cell is known on entry");
+
+                    if (!why)
+                    {
+                        i = t->offset;
+                        break;
+                    }
+                }
+
+                // keep the loop, only assuming what holds on every iteration
+                bool bal = balanced(p->in, i);
+                if (bal)
+                    forget_writes(p, i);
+                else
+                    forget_all(p);
+
+                flush_out(p);
+                push(p->out, LOOP_START, t->n, 0)->aux = t->aux;
+                prop(p, i + 1, t->offset);
+                flush_out(p);
+                push(p->out, LOOP_END, t->n, 0);
+
+                if (bal)
+                {
+                    p->pos = at;
+                    forget_writes(p, i);
+                }
+                else
+                    forget_all(p);
+                set(p, p->pos, 0);
+
+                i = t->offset;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+List_t *Const_Prop(List_t *tokens)
+{
+    Prop p;
+    p.in = tokens;
+    p.out = Cons(len(tokens) + 1);
+    p.val = calloc(SPAN, sizeof(unsigned char));
+    p.gen = calloc(SPAN, sizeof(unsigned));
+    p.log = NULL;
+    p.log_len = p.log_cap = 0;
+    p.depth = 0;
+    p.floor = 0;
+    p.pend = 0;
+    p.fuel = PROP_FUEL;
+
+    if (!p.val || !p.gen)
+    {
+        fprintf(stderr, "Could not allocate memory for constant propagation\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // the whole tape starts out known to be 0
+    p.cur = 1;
+    p.pos = 0;
+    for (long i = 0; i < TAPE_LEN; ++i)
+        p.gen[i] = p.cur;
+
+    prop(&p, 0, len(tokens));
+    flush_out(&p);
+
+    free(p.val);
+    free(p.gen);
+    free(p.log);
+    Destroy(tokens);
+
+    Comp_Loops(p.out);
+    return p.out;
+}
+
+// Idioms
+/*
+    Most programs are built out of the same few idioms, and the earlier passes leave each of
+    them as a fixed run of tokens. The runs are matched against a table of templates and
+    replaced by a single token that does the whole job:
+
+        [->+>+<<]>>[-<<+>>]<<                 =>   COPY      copy a cell through a temp cell
+        [->-<]+>[<->[-]]<                     =>   CMP(1)    x = x == y
+        [->-<]>[<+>[-]]<                      =>   CMP(0)    x = x != y
+        [->+>-[>+>>]>[+[-<+>]>+>>]<<<<<<]     =>   DIVMOD    n 0 d 0 0 0 0  =>  0 n d-n%d n%d n/d
+
+    A template is a list of tokens whose operands are either literals or variables. A variable
+    takes its value from the first token it is matched against and every later use has to agree,
+    which is how the template knows the pointer comes back to where it went. Pointer moves match
+    SHR and SHL alike, signed. Offsets held in variables must be nonzero and distinct.
+
+    COPY and CMP do exactly what their tokens did for any values. DIVMOD only does so if the
+    cells it uses as scratch start out as 0 (see Divmod in Kernel.c), which can't be known here,
+    so it is a guard: the template's tokens are kept after it, and run if it left the cell alone.
+*/
+
+extern const char *Flag_LT[];
+
+#define IDIOM_VARS 4    // variables a template can use, 1 up
+#define IDIOM_LEN 24    // most tokens in a template
+
+// An operand of a template, a literal or a (negated) variable
+typedef struct Term
+{
+    int value;
+    int var;    // 0 for a literal, k for variable k, -k for minus variable k
+} Term;
+
+#define L(x) {x, 0}
+#define V(k) {0, k}
+#define N(k) {0, -(k)}
+
+// A token of a template, SHR stands for any pointer move with n signed
+typedef struct Pattern
+{
+    Type flag;
+    Term n, offset;
+} Pattern;
+
+typedef struct Idiom
+{
+    Type flag;              // token the match is replaced by
+    Term n, offset, aux;    // its operands
+    Term move;              // pointer move left to do after it
+    bool guard;             // keep the matched tokens after it
+    size_t len;
+    Pattern pat[IDIOM_LEN];
+} Idiom;
+
+static const Idiom IDIOMS[] = {
+    // [->+>+<<]>>[-<<+>>]   into the cell at 1 through the temp cell at 2
+    {COPY, L(1), V(1), V(2), V(2), false, 6,
+        {{MUL, L(1), V(1)}, {MUL, L(1), V(2)}, {MEM_SET, L(0), L(0)},
+         {SHR, V(2), L(0)}, {MUL, L(1), N(2)}, {MEM_SET, L(0), L(0)}}},
+    // [->>+<+<]>>[-<<+>>]   the same with the temp cell filled first
+    {COPY, L(1), V(1), V(2), V(2), false, 6,
+        {{MUL, L(1), V(2)}, {MUL, L(1), V(1)}, {MEM_SET, L(0), L(0)},
+         {SHR, V(2), L(0)}, {MUL, L(1), N(2)}, {MEM_SET, L(0), L(0)}}},
+    // [->-<]+>[<->[-]]
+    {CMP, L(1), V(1), L(0), V(1), false, 9,
+        {{MUL, L(-1), V(1)}, {MEM_SET, L(1), L(0)}, {SHR, V(1), L(0)},
+         {LOOP_START, L(0), L(0)}, {SHR, N(1), L(0)}, {SUB, L(1), L(0)}, {SHR, V(1), L(0)}, {MEM_SET, L(0), L(0)},
+         {LOOP_END, L(0), L(0)}}},
+    // [->-<]>[<+>[-]]
+    {CMP, L(0), V(1), L(0), V(1), false, 9,
+        {{MUL, L(-1), V(1)}, {MEM_SET, L(0), L(0)}, {SHR, V(1), L(0)},
+         {LOOP_START, L(0), L(0)}, {SHR, N(1), L(0)}, {SUM, L(1), L(0)}, {SHR, V(1), L(0)}, {MEM_SET, L(0), L(0)},
+         {LOOP_END, L(0), L(0)}}},
+    // [->+>-[>+>>]>[+[-<+>]>+>>]<<<<<<]
+    {DIVMOD, L(1), L(0), L(0), L(0), true, 22,
+        {{LOOP_START, L(0), L(0)}, {SUB, L(1), L(0)}, {SHR, L(1), L(0)}, {SUM, L(1), L(0)}, {SHR, L(1), L(0)},
+         {SUB, L(1), L(0)}, {LOOP_START, L(0), L(0)}, {SHR, L(1), L(0)}, {SUM, L(1), L(0)}, {SHR, L(2), L(0)},
+         {LOOP_END, L(0), L(0)}, {SHR, L(1), L(0)}, {LOOP_START, L(0), L(0)}, {SUM, L(1), L(0)},
+         {MUL, L(1), L(-1)}, {MEM_SET, L(0), L(0)}, {SHR, L(1), L(0)}, {SUM, L(1), L(0)}, {SHR, L(2), L(0)},
+         {LOOP_END, L(0), L(0)}, {SHR, L(-6), L(0)}, {LOOP_END, L(0), L(0)}}},
+};
+
+#define IDIOM_COUNT (sizeof(IDIOMS) / sizeof(IDIOMS[0]))
+
+// Match a term against a value, binding its variable on first use
+static bool bind(Term t, int v, int *vars, bool *bound)
+{
+    if (!t.var)
+        return v == t.value;
+
+    int k = t.var > 0 ? t.var : -t.var;
+    v = t.var > 0 ? v : -v;
+
+    if (!bound[k])
+    {
+        vars[k] = v;
+        bound[k] = true;
+    }
+    return vars[k] == v;
+}
+
+static int value(Term t, int *vars)
+{
+    return !t.var ? t.value : t.var > 0 ? vars[t.var] : -vars[-t.var];
+}
+
+// Whether the tokens starting at i match a template, filling in its variables
+static bool match(List_t *tokens, size_t i, const Idiom *id, int *vars)
+{
+    bool bound[IDIOM_VARS + 1] = {false};
+
+    if (i + id->len > len(tokens))
+        return false;
+
+    for (size_t k = 0; k < id->len; ++k)
+    {
+        const Pattern *p = &id->pat[k];
+        Tok *t = tokens->data[i + k];
+
+        if (p->flag == SHR)
+        {
+            if ((t->flag != SHR && t->flag != SHL) || !bind(p->n, t->flag == SHR ? t->n : -t->n, vars, bound))
+                return false;
+        }
+        else if (t->flag != p->flag)
+            return false;
+        else if (t->flag != LOOP_START && t->flag != LOOP_END)
+        {
+            // cell values wrap, so compare them as bytes
+            int n = p->n.var ? t->n : (unsigned char)t->n;
+            Term want = p->n;
+            want.value = (unsigned char)want.value;
+
+            if (!bind(want, n, vars, bound) || !bind(p->offset, t->offset, vars, bound))
+                return false;
+        }
+    }
+
+    // variables are offsets, which have to point away from the current cell and from each other
+    for (int a = 1; a <= IDIOM_VARS; ++a)
+        for (int b = a; b <= IDIOM_VARS && bound[a]; ++b)
+            if (bound[b] && (!vars[b] || (a != b && vars[a] == vars[b])))
+                return false;
+
+    return true;
+}
+
+List_t *Idioms(List_t *tokens)
+{
+    List_t *out = Cons(len(tokens) + 1);
+    Take_Strs(out, tokens);
+
+    for (size_t i = 0; i < len(tokens); ++i)
+    {
+        Tok *t = tokens->data[i];
+        int vars[IDIOM_VARS + 1] = {0};
+        const Idiom *id = NULL;
+
+        for (size_t k = 0; k < IDIOM_COUNT && !id; ++k)
+            if (match(tokens, i, &IDIOMS[k], vars))
+                id = &IDIOMS[k];
+
+        if (id)
+        {
+            // a COPY has no loops left, the Optimizer reported them unrolled into its MULs
+            for (size_t k = i; k < i + id->len; ++k)
+                if (tokens->data[k]->flag == LOOP_START)
+                    Report_Loop(tokens, k, "rewritten by Idioms into a %s%s", Flag_LT[id->flag], id->guard ? " guard" : "");
+
+            push(out, id->flag, value(id->n, vars), value(id->offset, vars))->aux = value(id->aux, vars);
+
+            if (!id->guard)
+            {
+                shift(out, 0, value(id->move, vars));
+                i += id->len - 1;
+                continue;
+            }
+        }
+
+        if (t->flag == SHR || t->flag == SHL)
+            shift(out, 0, t->flag == SHR ? t->n : -t->n);
+        else
+            push(out, t->flag, t->n, t->offset)->aux = t->aux;
+    }
+
+    Destroy(tokens);
+
+    Comp_Loops(out);
+    return out;
+}
+
+// Dead store elimination
+/*
+    A store is dead if the cell is written again, or the program ends, before anything reads it
+
+        +++>-<[-]      =>   >-<[-]    ... => MEM_SET(0)   the adds are overwritten by the MEM_SET
+        ...>[-]<[-]    =>   (nothing)                     cleanup at the end of a program
+
+    Liveness is worked out backwards from the end of the program, where no cell is live.
+    Cells are named by their offset from the memory pointer, so the live set is a window of
+    LIVE_SPAN cells around the pointer that slides with every move, and a flag standing for
+    every cell outside it. Whenever a live cell slides out of the window that flag is set,
+    which is always safe: it can only keep stores that could have gone.
+
+    A loop that leaves the pointer where it found it is run 0 or more times, so the cells live
+    at its start are the cells live after it, the loop cell, and whatever its body needs live on
+    entry to run once more. That is found by iterating over the body until the set stops growing.
+    Loops that move the pointer, or that take too long to settle, make every cell live.
+
+    A store to a dead cell is dropped (IN is never dropped, it consumes input), and the pointer
+    moves left next to each other are merged afterwards. The pass runs before Vectorize, so it
+    never sees a MEM_RANGE or a MUL_VEC.
+*/
+
+#define LIVE_SPAN 64          // cells tracked around the pointer
+#define LIVE_ITERS 8          // most passes over a loop body before giving up on it
+#define LIVE_FUEL (1 << 22)   // most tokens the liveness pass will visit
+
+typedef struct Live
+{
+    uint64_t cells; // bit k is the cell at offset k - LIVE_SPAN / 2
+    bool rest;      // every cell outside the window
+} Live;
+
+typedef struct Dse
+{
+    List_t *in;
+    bool *dead;
+    long fuel;
+} Dse;
+
+static const Live ALL_LIVE = {~0ULL, true};
+
+static bool is_live(Live *l, long k)
+{
+    k += LIVE_SPAN / 2;
+    return k >= 0 && k < LIVE_SPAN ? (l->cells >> k) & 1 : l->rest;
+}
+
+static void gen(Live *l, long k)
+{
+    k += LIVE_SPAN / 2;
+    if (k >= 0 && k < LIVE_SPAN)
+        l->cells |= 1ULL << k;
+    else
+        l->rest = true;
+}
+
+static void kill(Live *l, long k)
+{
+    k += LIVE_SPAN / 2;
+    if (k >= 0 && k < LIVE_SPAN)
+        l->cells &= ~(1ULL << k);
+}
+
+// Going backwards over a move of the pointer by n, the cell at k afterwards is at k + n before it
+static void slide(Live *l, long n)
+{
+    uint64_t in = l->rest ? ~0ULL : 0;
+
+    if (n >= LIVE_SPAN || n <= -LIVE_SPAN)
+    {
+        l->rest |= l->cells != 0;
+        l->cells = in;
+    }
+    else if (n > 0)
+    {
+        l->rest |= (l->cells >> (LIVE_SPAN - n)) != 0;
+        l->cells = (l->cells << n) | (in >> (LIVE_SPAN - n));
+    }
+    else if (n < 0)
+    {
+        l->rest |= (l->cells << (LIVE_SPAN + n)) != 0;
+        l->cells = (l->cells >> -n) | (in << (LIVE_SPAN + n));
+    }
+}
+
+static bool same(Live a, Live b)
+{
+    return a.cells == b.cells && a.rest == b.rest;
+}
+
+static Live join(Live a, Live b)
+{
+    return (Live){a.cells | b.cells, a.rest || b.rest};
+}
+
+// Work liveness backwards through the tokens in [lo, hi), marking dead stores if apply is set
+static void live(Dse *d, size_t lo, size_t hi, Live *l, bool apply)
+{
+    for (size_t i = hi; i-- > lo;)
+    {
+        Tok *t = d->in->data[i];
+        bool dead = false;
+        d->fuel--;
+
+        switch (t->flag)
+        {
+            case SUM:
+            case SUB:
+                dead = !is_live(l, 0);
+                break;
+            case MEM_SET:
+                dead = !is_live(l, 0);
+                kill(l, 0);
+                break;
+            case SHR:
+                slide(l, t->n);
+                break;
+            case SHL:
+                slide(l, -t->n);
+                break;
+            case OUT:
+                gen(l, 0);
+                break;
+            case IN:
+                kill(l, 0);
+                break;
+            case MUL:
+                dead = !is_live(l, t->offset);
+                if (!dead)
+                    gen(l, 0);
+                break;
+            case COPY:
+                gen(l, t->aux);
+                gen(l, t->offset);
+                gen(l, 0);
+                break;
+            case CMP:
+                gen(l, t->offset);
+                gen(l, 0);
+                break;
+            case DIVMOD:
+                for (int k = 0; k <= 6; ++k)
+                    gen(l, k);
+                break;
+            case LOOP_END:
+            {
+                size_t start = t->offset;
+                Live head = ALL_LIVE;
+
+                // a loop the profile never saw run keeps everything live rather than iterate
+                if (d->fuel > 0 && !Profile_Cold(d->in->data[start]->aux) && balanced(d->in, start))
+                {
+                    // grow the set live at the loop's start until it settles
+                    Live h = *l;
+                    gen(&h, 0);
+
+                    for (int iter = 0; iter < LIVE_ITERS && d->fuel > 0; ++iter)
+                    {
+                        Live body = h;
+                        live(d, start + 1, i, &body, false);
+                        body = join(body, h);
+
+                        if (same(body, h))
+                        {
+                            head = h;
+                            break;
+                        }
+                        h = body;
+                    }
+                }
+
+                Live body = head;
+                live(d, start + 1, i, &body, apply);
+                *l = head;
+                i = start;
+                break;
+            }
+            default:
+                break;
+        }
+
+        if (apply && dead)
+            d->dead[i] = true;
+    }
+}
+
+List_t *Dead_Stores(List_t *tokens)
+{
+    Dse d;
+    d.in = tokens;
+    d.dead = calloc(len(tokens) + 1, sizeof(bool));
+    d.fuel = LIVE_FUEL;
+
+    if (!d.dead)
+    {
+        fprintf(stderr, "Could not allocate memory for dead store elimination\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // nothing is live once the program ends
+    Live end = {0, false};
+    live(&d, 0, len(tokens), &end, true);
+
+    List_t *out = Cons(len(tokens) + 1);
+    Take_Strs(out, tokens);
+
+    for (size_t i = 0; i < len(tokens); ++i)
+    {
+        Tok *t = tokens->data[i];
+
+        if (d.dead[i])
+            continue;
+
+        if (t->flag == SHR || t->flag == SHL)
+            shift(out, 0, t->flag == SHR ? t->n : -t->n);
+        else
+            push(out, t->flag, t->n, t->offset)->aux = t->aux;
+    }
+
+    free(d.dead);
+    Destroy(tokens);
+
+    Comp_Loops(out);
+    return out;
+}
+
+// Vectorization
+/*
+    Clearing a row of cells and fanning a cell out to many others both come out of the
+    earlier passes as runs of tokens that each touch one cell:
+
+        [-]>[-]>[-]>[-]        =>   MEM_SET(0) SHR(1) MEM_SET(0) ...   =>   MEM_RANGE(0, n:= 4) SHR(3)
+        [->+>++>+++<<<]        =>   MUL(1) MUL(2) MUL(3) MEM_SET(0)    =>   MUL_VEC(1, 2, 3) MEM_SET(0)
+
+    MEM_RANGE sets a window of cells to one value and MUL_VEC adds the current cell times a vector
+    of coefficients to a window, the coefficients live in the string table. Both run as SIMD kernels.
+
+    The MULs from one loop all read the same cell and never write it, so they can be done in any
+    order, and MULs to the same cell add up. A window can't be wider than VEC_SPAN,
+    a run that spreads out further is left as it is.
+*/
+
+// Length of the run of MEM_SETs to the same value starting at i, with every cell next to the last
+static size_t range_run(List_t *tokens, size_t i, int *dir)
+{
+    Tok *t = tokens->data[i];
+    size_t count = 1;
+    *dir = 0;
+
+    while (i + 2 < len(tokens))
+    {
+        Tok *mv = tokens->data[i + 1], *set = tokens->data[i + 2];
+        int d = mv->flag == SHR ? 1 : mv->flag == SHL ? -1 : 0;
+
+        if (!d || mv->n != 1 || (*dir && d != *dir)
+            || set->flag != MEM_SET || (unsigned char)set->n != (unsigned char)t->n)
+            break;
+
+        *dir = d;
+        count++;
+        i += 2;
+    }
+
+    return count;
+}
+
+// Length of the run of MULs starting at i, and the window they write to
+static size_t mul_run(List_t *tokens, size_t i, int *lo, int *hi)
+{
+    size_t count = 0;
+    *lo = *hi = tokens->data[i]->offset;
+
+    for (; i < len(tokens) && tokens->data[i]->flag == MUL; ++i, ++count)
+    {
+        int at = tokens->data[i]->offset;
+        int l = at < *lo ? at : *lo, h = at > *hi ? at : *hi;
+
+        if (h - l >= VEC_SPAN)
+            break;
+        *lo = l;
+        *hi = h;
+    }
+
+    return count;
+}
+
+List_t *Vectorize(List_t *tokens)
+{
+    List_t *out = Cons(len(tokens) + 1);
+    Take_Strs(out, tokens);
+
+    for (size_t i = 0; i < len(tokens); ++i)
+    {
+        Tok *t = tokens->data[i];
+        size_t count;
+        int dir, lo, hi;
+
+        if (t->flag == MEM_SET && (count = range_run(tokens, i, &dir)) >= RANGE_MIN)
+        {
+            int last = (count - 1) * dir;
+
+            push(out, MEM_RANGE, count, dir < 0 ? last : 0)->aux = (unsigned char)t->n;
+            shift(out, 0, last);
+            i += 2 * (count - 1);
+        }
+        else if (t->flag == MUL && (count = mul_run(tokens, i, &lo, &hi)) >= VEC_MIN)
+        {
+            unsigned char coef[VEC_SPAN] = {0};
+            for (size_t k = i; k < i + count; ++k)
+                coef[tokens->data[k]->offset - lo] += tokens->data[k]->n;
+
+            size_t at = Append_Str(out, (char *)coef, hi - lo + 1);
+            push(out, MUL_VEC, hi - lo + 1, lo)->aux = at;
+            i += count - 1;
+        }
+        else if (t->flag == SHR || t->flag == SHL)
+            shift(out, 0, t->flag == SHR ? t->n : -t->n);
+        else
+        {
+            // copy the token over, loop offsets are recomputed below
+            Tok *c = push(out, t->flag, t->n, t->offset);
+            c->aux = t->aux;
+        }
+    }
+
+    Destroy(tokens);
+
+    Comp_Loops(out);
+    return out;
+}
+
+// If conversion
+/*
+    A loop whose body leaves the pointer where it found it and ends by clearing the loop cell
+    can only run once, the check at its end always falls through:
+
+        [>+<[-]]            =>   IF SHR(1) SUM(1) SHL(1) MEM_SET(0) END_IF
+        [->+<]>[<+>[-]]     =>   ... IF ... END_IF
+
+    IF is a single forward branch with no back edge, so the interpreter, the JIT and the C
+    output all run the body as straight line code. If the body is nothing but MULs and the
+    final clear it doesn't need the IF at all, every one of those does nothing on a zero cell.
+*/
+
+// Whether a token leaves the current cell 0
+static bool zeroes(Tok *t)
+{
+    return (t->flag == MEM_SET && !(unsigned char)t->n)
+           || (t->flag == MEM_RANGE && !t->aux && t->offset <= 0 && t->offset + t->n > 0);
+}
+
+// Whether the loop starting at i runs at most once
+static bool at_most_once(List_t *tokens, size_t i)
+{
+    size_t end = tokens->data[i]->offset;
+    return end > i + 1 && zeroes(tokens->data[end - 1]) && balanced(tokens, i);
+}
+
+// Whether a loop that runs at most once does nothing if it isn't entered anyway
+static bool no_op_on_zero(List_t *tokens, size_t i)
+{
+    size_t end = tokens->data[i]->offset;
+    if (tokens->data[end - 1]->flag != MEM_SET)
+        return false;
+
+    for (size_t k = i + 1; k < end - 1; ++k)
+        if (tokens->data[k]->flag != MUL && tokens->data[k]->flag != MUL_VEC)
+            return false;
+
+    return true;
+}
+
+List_t *If_Convert(List_t *tokens)
+{
+    size_t n = len(tokens);
+    List_t *out = Cons(n + 1);
+    Take_Strs(out, tokens);
+
+    // what each token becomes, COM for a bracket that is dropped
+    Type *as = malloc(sizeof(Type) * (n + 1));
+    if (!as)
+    {
+        fprintf(stderr, "Could not allocate memory for if conversion\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        as[i] = tokens->data[i]->flag;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (as[i] != LOOP_START || !at_most_once(tokens, i))
+            continue;
+
+        bool flat = no_op_on_zero(tokens, i);
+        Report_Loop(tokens, i, flat ? "brackets dropped by If_Convert, its body does nothing on a 0 cell"
+                                    : "made an IF by If_Convert, it runs at most once");
+        as[i] = flat ? COM : IF;
+        as[tokens->data[i]->offset] = flat ? COM : END_IF;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        Tok *t = tokens->data[i];
+        if (as[i] != COM)
+            push(out, as[i], t->n, t->offset)->aux = t->aux;
+    }
+
+    free(as);
+    Destroy(tokens);
+
+    Comp_Loops(out);
+    return out;
+}
@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "List.h"
+#include "Par.h"
+#include "Report.h"
+#include "nerv.h"
+
+/*
+    Lexing and optimizing on several threads
+
+    Large sources are cut into one chunk per thread, each lexed on its own. A cut is never put
+    inside a run of the same character, so at O1 and up the runs come out as they would from a
+    single pass. Loops can span chunks, so brackets are matched in two steps:
+
+        1    every chunk matches what it can on its own, what is left is a run of ] followed by
+             a run of [ (a ] after an open [ would have closed it)
+        2    the chunks are walked in order with one stack, the ] of a chunk close the [ left
+             open by the chunks before it, then its own [ go on the stack
+
+    A prefix sum over the token counts of the chunks gives where each one starts in the list,
+    and one over their loop counts how to renumber their loops, so the tokens can be copied
+    over and fixed up in parallel too.
+
+    The Optimizer only looks at the next token and the loop it is in, so a list cut in front
+    of top level loops can be optimized piece by piece. A cut right after a loop would hide
+    the dead loop that follows it, so those are skipped. The pieces come back in order and
+    are stitched together the same way.
+*/
+
+static size_t threads = 0;
+
+size_t Par_Threads(void)
+{
+    if (threads)
+        return threads;
+
+    const char *env = getenv("NERV_THREADS");
+    long n = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n < 1 ? 1 : n > PAR_MAX ? PAR_MAX : (size_t)n;
+}
+
+void Set_Threads(size_t n)
+{
+    threads = n > PAR_MAX ? PAR_MAX : n;
+}
+
+// Run fn on each of n args, one thread each
+static void run_all(void *(*fn)(void *), void *args, size_t size, size_t n)
+{
+    pthread_t ids[PAR_MAX];
+
+    for (size_t k = 0; k < n; ++k)
+    {
+        if (pthread_create(&ids[k], NULL, fn, (char *)args + k * size))
+        {
+            fprintf(stderr, "Could not start a thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (size_t k = 0; k < n; ++k)
+        pthread_join(ids[k], NULL);
+}
+
+typedef struct Chunk
+{
+    const char *p;
+    size_t lo, hi;
+    Opt opt;
+
+    List_t *tokens;
+    // brackets left unmatched, as indices into tokens
+    size_t *open, *close;
+    size_t n_open, n_close;
+    int n_loops;
+
+    List_t *out;
+    size_t base;    // index of the first token in out
+    int loops;      // loops in the chunks before this one
+} Chunk;
+
+// Lex a chunk and match the brackets inside it
+static void *lex_chunk(void *arg)
+{
+    Chunk *c = arg;
+
+    c->tokens = Cons(c->hi - c->lo + 1);
+    Lex_Range(c->p, c->lo, c->hi, c->opt, c->tokens);
+
+    size_t n = len(c->tokens);
+    c->open = malloc(sizeof(size_t) * (n + 1));
+    c->close = malloc(sizeof(size_t) * (n + 1));
+    if (!c->open || !c->close)
+    {
+        fprintf(stderr, "Could not allocate memory for bracket matching\n");
+        exit(EXIT_FAILURE);
+    }
+
+    c->n_open = c->n_close = 0;
+    c->n_loops = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        Tok *t = c->tokens->data[i];
+
+        if (t->flag == LOOP_START)
+        {
+            t->offset = -1;
+            c->open[c->n_open++] = i;
+            c->n_loops++;
+        }
+        else if (t->flag == LOOP_END)
+        {
+            t->offset = -1;
+            if (c->n_open)
+            {
+                size_t j = c->open[--c->n_open];
+                c->tokens->data[j]->offset = i;
+                t->offset = j;
+            }
+            else
+                c->close[c->n_close++] = i;
+        }
+    }
+
+    return NULL;
+}
+
+// Copy a chunk into place and move the offsets it matched along with it, and the loop numbers
+static void *place_chunk(void *arg)
+{
+    Chunk *c = arg;
+    Tok **to = c->out->data + c->base;
+
+    for (size_t i = 0; i < len(c->tokens); ++i)
+    {
+        Tok *t = c->tokens->data[i];
+
+        if ((t->flag == LOOP_START || t->flag == LOOP_END) && t->offset >= 0)
+            t->offset += c->base;
+        if (t->flag == LOOP_START)
+            t->aux += c->loops;
+        to[i] = t;
+    }
+
+    return NULL;
+}
+
+List_t *Par_Lex(const char *p, size_t ln, Opt opt)
+{
+    size_t n = Par_Threads();
+    Chunk chunks[PAR_MAX];
+
+    // cut at even splits, pushed past any run they land in
+    size_t lo = 0;
+    for (size_t k = 0; k < n; ++k)
+    {
+        size_t hi = k + 1 == n ? ln : (k + 1) * ln / n;
+        hi = hi < lo ? lo : hi;
+        while (hi > 0 && hi < ln && p[hi] == p[hi - 1] && strchr("><+-", p[hi]))
+            hi++;
+
+        chunks[k] = (Chunk){p, lo, hi, opt, NULL, NULL, NULL, 0, 0, 0, NULL, 0, 0};
+        lo = hi;
+    }
+
+    run_all(lex_chunk, chunks, sizeof(Chunk), n);
+
+    size_t total = 0;
+    int loops = 0;
+    for (size_t k = 0; k < n; ++k)
+    {
+        chunks[k].base = total;
+        chunks[k].loops = loops;
+        total += len(chunks[k].tokens);
+        loops += chunks[k].n_loops;
+    }
+
+    List_t *out = Cons(total + 1);
+    out->len = total;
+    for (size_t k = 0; k < n; ++k)
+        chunks[k].out = out;
+
+    run_all(place_chunk, chunks, sizeof(Chunk), n);
+
+    // match what crosses chunks
+    size_t *stack = malloc(sizeof(size_t) * (total + 1));
+    size_t depth = 0;
+    if (!stack)
+    {
+        fprintf(stderr, "Could not allocate memory for bracket matching\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t k = 0; k < n; ++k)
+    {
+        Chunk *c = &chunks[k];
+
+        for (size_t i = 0; i < c->n_close; ++i)
+        {
+            assert(depth);
+            size_t j = stack[--depth], at = c->base + c->close[i];
+            out->data[j]->offset = at;
+            out->data[at]->offset = j;
+        }
+
+        for (size_t i = 0; i < c->n_open; ++i)
+            stack[depth++] = c->base + c->open[i];
+
+        free(c->open);
+        free(c->close);
+        free(c->tokens->data);
+        free(c->tokens);
+    }
+
+    assert(!depth);
+    free(stack);
+
+    return out;
+}
+
+typedef struct Piece
+{
+    List_t *tokens;
+} Piece;
+
+static void *optimize_piece(void *arg)
+{
+    Piece *pc = arg;
+    Tok **data = pc->tokens->data;
+
+    // the Optimizer frees the list but not its array
+    pc->tokens = Optimizer(pc->tokens);
+    free(data);
+
+    return NULL;
+}
+
+List_t *Par_Optimizer(List_t *tokens)
+{
+    size_t n = Par_Threads(), total = len(tokens);
+
+    // lines of the report from several threads would interleave
+    if (n <= 1 || total < PAR_OPT_MIN || Reporting())
+        return Optimizer(tokens);
+
+    // cut in front of the first safe top level loop past each even split
+    size_t cuts[PAR_MAX + 1], pieces = 0;
+    int depth = 0;
+
+    cuts[pieces++] = 0;
+    for (size_t i = 0; i < total && pieces < n; ++i)
+    {
+        Tok *t = tokens->data[i];
+
+        if (t->flag == LOOP_START && !depth && i >= pieces * total / n && tokens->data[i - 1]->flag != LOOP_END)
+            cuts[pieces++] = i;
+
+        depth += (t->flag == LOOP_START) - (t->flag == LOOP_END);
+    }
+    cuts[pieces] = total;
+
+    Piece ps[PAR_MAX];
+    for (size_t k = 0; k < pieces; ++k)
+    {
+        size_t lo = cuts[k], hi = cuts[k + 1];
+        List_t *piece = Cons(hi - lo + 1);
+
+        for (size_t i = lo; i < hi; ++i)
+        {
+            Tok *t = tokens->data[i];
+            if (t->flag == LOOP_START || t->flag == LOOP_END)
+                t->offset -= lo;
+            Append(piece, t);
+        }
+
+        ps[k].tokens = piece;
+    }
+
+    run_all(optimize_piece, ps, sizeof(Piece), pieces);
+
+    size_t size = 0;
+    for (size_t k = 0; k < pieces; ++k)
+        size += len(ps[k].tokens);
+
+    List_t *out = Cons(size + 1);
+    for (size_t k = 0; k < pieces; ++k)
+    {
+        List_t *piece = ps[k].tokens;
+        size_t base = len(out);
+
+        for (size_t i = 0; i < len(piece); ++i)
+        {
+            Tok *t = piece->data[i];
+            if (t->flag == LOOP_START || t->flag == LOOP_END)
+                t->offset += base;
+            Append(out, t);
+        }
+
+        free(piece->data);
+        free(piece);
+    }
+
+    Destroy(tokens);
+
+    return out;
+}
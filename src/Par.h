@@ -0,0 +1,21 @@
+#ifndef __PAR_H
+#define __PAR_H
+
+#include <stddef.h>
+#include "List.h"
+#include "Opt.h"
+
+#define PAR_MAX 16              // most threads used
+#define PAR_LEX_MIN (1 << 20)   // fewest bytes of source worth lexing on several threads
+#define PAR_OPT_MIN (1 << 14)   // fewest tokens worth optimizing on several threads
+
+// Number of threads to use, NERV_THREADS if it is set, the number of CPUs otherwise
+size_t Par_Threads(void);
+// Use n threads, 0 to go back to the default
+void Set_Threads(size_t);
+// Lex a program of ln bytes on several threads, same result as lexing it on one
+List_t *Par_Lex(const char *, size_t, Opt);
+// Run the Optimizer over independent top level loops on several threads, same result as Optimizer
+List_t *Par_Optimizer(List_t *);
+
+#endif
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "List.h"
+#include "Profile.h"
+#include "Trace.h"
+
+/*
+    Profile guided optimization
+
+    With --profile a run of the program keeps stats on every loop and IF: how often its [ was
+    reached, how many entries ran the body and how many found a 0, the fewest and most
+    iterations an entry took and the cells it was entered on. They are written to a file by the
+    number the Lexer gives each loop of the source, so a profile taken at one level can be used
+    at another, and a run with --use-profile compiles with it:
+
+        cold loops    the body never ran, so Const_Prop doesn't unroll them and Dead_Stores
+                      doesn't iterate over them, the effort goes where the run spends its time
+        hot loops     ran at least PROFILE_HOT iterations, their trace is built before the run
+                      instead of after TRACE_HOT entries, and a loop that runs PROFILE_LONG
+                      iterations an entry or more goes straight to native code
+        nervc         cold loops are marked unlikely, so the C compiler moves them out of the way
+
+    A profile is a guess about the next run, nothing it says changes what the program does.
+
+        ./nerv examples/Frac.bf -O2 --profile frac.prof
+        ./nerv examples/Frac.bf -O2 --use-profile frac.prof
+        ./nerv examples/Frac.bf -O2 --use-profile frac.prof --compile frac.c
+*/
+
+#define PROFILE_MAGIC "nerv profile"
+
+static void *alloc(size_t n, size_t size)
+{
+    void *p = calloc(n, size);
+    if (!p)
+    {
+        fprintf(stderr, "Could not allocate memory for the profile\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+void Profile_Enable(State_t *s)
+{
+    Profiler *prof = alloc(1, sizeof(Profiler));
+
+    prof->stats = alloc(len(s->tokens), sizeof(Loop_Stats));
+    prof->trip = alloc(len(s->tokens), sizeof(uint64_t));
+    s->prof = prof;
+}
+
+void Profile_Disable(State_t *s)
+{
+    Profiler *prof = s->prof;
+    if (!prof)
+        return;
+
+    free(prof->stats);
+    free(prof->trip);
+    free(prof);
+    s->prof = NULL;
+}
+
+void Profile_Enter(Profiler *prof, size_t ip, size_t cell, bool runs)
+{
+    Loop_Stats *st = &prof->stats[ip];
+
+    st->reached++;
+
+    // the first check of an entry, the others are its back edges
+    if (!prof->trip[ip])
+    {
+        if (st->reached == 1 || cell < st->lo)
+            st->lo = cell;
+        if (cell > st->hi)
+            st->hi = cell;
+        if (!runs)
+            st->skipped++;
+    }
+
+    if (runs)
+        prof->trip[ip]++;
+}
+
+void Profile_Exit(Profiler *prof, size_t ip)
+{
+    Loop_Stats *st = &prof->stats[ip];
+    uint64_t trip = prof->trip[ip];
+
+    if (!trip)
+        return;
+
+    if (!st->entries || trip < st->min_trip)
+        st->min_trip = trip;
+    if (trip > st->max_trip)
+        st->max_trip = trip;
+    st->entries++;
+    prof->trip[ip] = 0;
+}
+
+// Fold the stats of b into a, both of the same loop of the source
+static void merge(Loop_Stats *a, const Loop_Stats *b)
+{
+    if (!b->reached)
+        return;
+
+    if (!a->reached || b->lo < a->lo)
+        a->lo = b->lo;
+    if (b->hi > a->hi)
+        a->hi = b->hi;
+    if (b->entries && (!a->entries || b->min_trip < a->min_trip))
+        a->min_trip = b->min_trip;
+    if (b->max_trip > a->max_trip)
+        a->max_trip = b->max_trip;
+
+    a->reached += b->reached;
+    a->skipped += b->skipped;
+    a->entries += b->entries;
+}
+
+Profile *Take_Profile(State_t *s, uint64_t prog)
+{
+    List_t *tokens = s->tokens;
+    Profile *pr = alloc(1, sizeof(Profile));
+
+    pr->prog = prog;
+    pr->loops = 0;
+    for (size_t ip = 0; ip < len(tokens); ++ip)
+    {
+        Tok *t = tokens->data[ip];
+        if ((t->flag == LOOP_START || t->flag == IF) && t->aux > 0 && (size_t)t->aux > pr->loops)
+            pr->loops = t->aux;
+    }
+
+    pr->stats = alloc(pr->loops + 1, sizeof(Loop_Stats));
+    if (!s->prof)
+        return pr;
+
+    // a loop of the source may have been split in several tokens, or none
+    for (size_t ip = 0; ip < len(tokens); ++ip)
+    {
+        Tok *t = tokens->data[ip];
+        if ((t->flag == LOOP_START || t->flag == IF) && t->aux > 0)
+            merge(&pr->stats[t->aux], &s->prof->stats[ip]);
+    }
+
+    return pr;
+}
+
+bool Save_Profile(Profile *pr, const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return false;
+
+    fprintf(fp, "%s\nprogram %016llx\nloops %zu\n", PROFILE_MAGIC, (unsigned long long)pr->prog, pr->loops);
+
+    // loop reached skipped entries min max lo hi, for the loops that were reached
+    for (size_t k = 1; k <= pr->loops; ++k)
+    {
+        Loop_Stats *st = &pr->stats[k];
+        if (st->reached)
+            fprintf(fp, "%zu %llu %llu %llu %llu %llu %zu %zu\n", k, (unsigned long long)st->reached,
+                    (unsigned long long)st->skipped, (unsigned long long)st->entries,
+                    (unsigned long long)st->min_trip, (unsigned long long)st->max_trip, st->lo, st->hi);
+    }
+
+    return !fclose(fp);
+}
+
+Profile *Load_Profile(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return NULL;
+
+    char magic[sizeof(PROFILE_MAGIC)];
+    unsigned long long prog;
+    size_t loops;
+
+    // the Lexer numbers loops with an int, a profile with more isn't one of anything it read
+    if (!fgets(magic, sizeof(magic), fp) || strcmp(magic, PROFILE_MAGIC)
+        || fscanf(fp, " program %llx loops %zu", &prog, &loops) != 2
+        || loops > INT_MAX || loops > SIZE_MAX / sizeof(Loop_Stats) - 1)
+    {
+        fclose(fp);
+        return NULL;
+    }
+
+    Profile *pr = alloc(1, sizeof(Profile));
+    pr->prog = prog;
+    pr->loops = loops;
+    pr->stats = alloc(loops + 1, sizeof(Loop_Stats));
+
+    size_t k, lo, hi;
+    unsigned long long reached, skipped, entries, min_trip, max_trip;
+    while (fscanf(fp, "%zu %llu %llu %llu %llu %llu %zu %zu", &k, &reached, &skipped, &entries,
+                  &min_trip, &max_trip, &lo, &hi) == 8)
+    {
+        if (!k || k > loops)
+            continue;
+
+        pr->stats[k] = (Loop_Stats){reached, skipped, entries, min_trip, max_trip, lo, hi};
+    }
+
+    // anything left over is not a line of stats
+    bool ok = feof(fp);
+    fclose(fp);
+    if (!ok)
+    {
+        Profile_Destroy(pr);
+        return NULL;
+    }
+
+    return pr;
+}
+
+void Profile_Destroy(Profile *pr)
+{
+    if (!pr)
+        return;
+
+    free(pr->stats);
+    free(pr);
+}
+
+static Profile *use = NULL;
+
+void Use_Profile(Profile *pr)
+{
+    use = pr;
+}
+
+bool Profile_Cold(int loop)
+{
+    // loops the Lexer didn't number, made by a pass, are never cold
+    if (!use || loop <= 0 || (size_t)loop > use->loops)
+        return false;
+
+    return !use->stats[loop].entries;
+}
+
+void Profile_Warm(State_t *s)
+{
+    List_t *tokens = s->tokens;
+
+    if (!use)
+        return;
+
+    for (size_t ip = 0; ip < len(tokens); ++ip)
+    {
+        Tok *t = tokens->data[ip];
+        if (t->flag != LOOP_START || t->aux <= 0 || (size_t)t->aux > use->loops)
+            continue;
+
+        Loop_Stats *st = &use->stats[t->aux];
+        uint64_t iters = st->reached - st->skipped;
+        if (iters < PROFILE_HOT || !st->entries)
+            continue;
+
+        // Hot_Loop moves a loop up a tier on the entry that reaches its threshold, so go through both
+        Hot *h = Hot_Loop(s, ip);
+        h->hits = TRACE_HOT - 1;
+        Hot_Loop(s, ip);
+
+        if (iters / st->entries >= PROFILE_LONG)
+        {
+            h->hits = JIT_HOT - 1;
+            Hot_Loop(s, ip);
+        }
+    }
+}
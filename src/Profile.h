@@ -0,0 +1,62 @@
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "List.h"
+#include "State.h"
+
+#define PROFILE_HOT 4096    // iterations that make a loop hot
+#define PROFILE_LONG 16     // mean trip count of a hot loop worth compiling to native code before the run
+
+// What a run saw of a loop, or an IF
+typedef struct Loop_Stats
+{
+    uint64_t reached;   // times its [ was reached, once an iteration and once for every entry on a 0 cell
+    uint64_t skipped;   // entries on a 0 cell, where the body never ran
+    uint64_t entries;   // entries that ran the body
+    uint64_t min_trip, max_trip;    // fewest and most iterations of one of those entries
+    size_t lo, hi;      // lowest and highest cell it was entered on
+} Loop_Stats;
+
+// Stats of a running state, indexed by token
+typedef struct Profiler
+{
+    Loop_Stats *stats;
+    uint64_t *trip;     // iterations of the entry under way, 0 outside the loop
+} Profiler;
+
+// Stats of a program, indexed by the loop numbers the Lexer gives, 0 is unused
+typedef struct Profile
+{
+    uint64_t prog;      // hash of the source the profile was taken from
+    size_t loops;
+    Loop_Stats *stats;
+} Profile;
+
+// Collect stats on a state's loops as it runs, this keeps it in the interpreter
+void Profile_Enable(State_t *);
+// Stop collecting stats and free them
+void Profile_Disable(State_t *);
+// Called by Step on reaching a loop or IF at a cell, runs is whether its body runs
+void Profile_Enter(Profiler *, size_t, size_t, bool);
+// Called by Step when a loop or IF whose body ran is left, with the ip of its start
+void Profile_Exit(Profiler *, size_t);
+// Gather the stats of a state by loop of the source, the hash is that of the source
+Profile *Take_Profile(State_t *, uint64_t);
+// Write a profile to a file
+bool Save_Profile(Profile *, const char *);
+// Read a profile from a file, NULL if it is not a profile or has more loops than a program can
+Profile *Load_Profile(const char *);
+// Destructor
+void Profile_Destroy(Profile *);
+
+// Compile with a profile from now on, NULL to stop
+void Use_Profile(Profile *);
+// Whether the profile in use says the body of a loop never ran
+bool Profile_Cold(int);
+// Build traces and native code before the run for the loops the profile in use says are hot
+void Profile_Warm(State_t *);
+
+#endif
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "List.h"
+#include "Report.h"
+#include "Profile.h"
+
+/*
+    Optimization report
+
+    With --report the Optimizer writes what it did with each loop of the source: unrolled it
+    into MULs, cleared it, removed it as dead, or kept it and why. The passes after it add a
+    line whenever they decide about a loop that is still there: Const_Prop unrolling, removing
+    or keeping one entered on a known cell, Idioms rewriting one, If_Convert making one an IF.
+    Loops are numbered in source order, the 3rd [ of the source is loop 3. Every pass of the Lexer notes how many tokens went
+    in and came out, the Lexer itself counts characters in, and those are written once the
+    program is done along with how many tokens of each type it ended up with.
+
+    The program is then run with every loop and IF profiled, which keeps it in the interpreter,
+    and its loop nest is written as Graphviz DOT, one node per loop with its size and counts
+
+        ./nerv examples/Frac.bf -O2 --report frac.dot
+        dot -Tsvg frac.dot > frac.svg
+*/
+
+extern const char *Flag_LT[];
+
+#define REPORT_PASSES 16
+
+static FILE *report = NULL;
+
+static struct
+{
+    const char *name;
+    size_t before, after;
+} passes[REPORT_PASSES];
+static size_t n_passes = 0;
+
+// whether the loops header has been written
+static bool listed = false;
+
+void Report_To(FILE *fp)
+{
+    report = fp;
+    listed = false;
+    n_passes = 0;
+}
+
+bool Reporting(void)
+{
+    return report != NULL;
+}
+
+void Report_Pass(const char *name, size_t before, size_t after)
+{
+    if (!report || n_passes == REPORT_PASSES)
+        return;
+
+    passes[n_passes].name = name;
+    passes[n_passes].before = before;
+    passes[n_passes].after = after;
+    n_passes++;
+}
+
+void Report_Loop(List_t *tokens, size_t i, const char *fmt, ...)
+{
+    if (!report)
+        return;
+
+    va_list args;
+    va_start(args, fmt);
+
+    if (!listed)
+        fprintf(report, "loops\n");
+    listed = true;
+
+    // the Lexer numbers loops in source order
+    fprintf(report, "  loop %-8d", tokens->data[i]->aux);
+    vfprintf(report, fmt, args);
+    fputc('\n', report);
+
+    va_end(args);
+}
+
+void Report_Program(List_t *tokens)
+{
+    if (!report)
+        return;
+
+    fprintf(report, "passes%20s%12s\n", "before", "after");
+    for (size_t k = 0; k < n_passes; ++k)
+    {
+        size_t before = passes[k].before, after = passes[k].after;
+        double change = before ? 100.0 * ((double)after - before) / before : 0.0;
+
+        fprintf(report, "  %-12s%12zu%12zu  (%+.1f%%)\n", passes[k].name, before, after, change);
+    }
+    n_passes = 0;
+
+    size_t counts[END_IF + 1] = {0};
+    for (size_t i = 0; i < len(tokens); ++i)
+        counts[tokens->data[i]->flag]++;
+
+    fprintf(report, "tokens\n");
+    for (Type t = SUM; t <= END_IF; ++t)
+        if (counts[t])
+            fprintf(report, "  %-12s%12zu\n", Flag_LT[t], counts[t]);
+}
+
+void Report_Dot(State_t *s, FILE *fp)
+{
+    List_t *tokens = s->tokens;
+    size_t n = len(tokens);
+
+    // node 0 is the whole program, a loop or IF is node ip + 1
+    size_t *open = malloc(sizeof(size_t) * (n + 1));
+    if (!open)
+    {
+        fprintf(stderr, "Could not allocate memory for the loop nest\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(fp, "digraph loops {\n");
+    fprintf(fp, "    node [shape=box, fontname=monospace];\n");
+    fprintf(fp, "    n0 [label=\"program\\n%zu tokens\"];\n", n);
+
+    size_t depth = 0;
+    open[depth] = 0;
+    for (size_t ip = 0; ip < n; ++ip)
+    {
+        Tok *t = tokens->data[ip];
+
+        if (t->flag == LOOP_END || t->flag == END_IF)
+        {
+            depth--;
+            continue;
+        }
+        if (t->flag != LOOP_START && t->flag != IF)
+            continue;
+
+        int body = t->offset - (int)ip - 1;
+        fprintf(fp, "    n%zu [label=\"%s %d @%zu\\n%d token%s", ip + 1, t->flag == IF ? "if" : "loop", t->aux, ip, body, body == 1 ? "" : "s");
+        if (s->prof)
+        {
+            Loop_Stats *st = &s->prof->stats[ip];
+            fprintf(fp, "\\nreached %llu time%s, ran %llu\"%s];\n", (unsigned long long)st->reached, st->reached == 1 ? "" : "s",
+                    (unsigned long long)st->entries, st->entries ? "" : ", color=gray, fontcolor=gray");
+        }
+        else
+            fprintf(fp, "\"];\n");
+        fprintf(fp, "    n%zu -> n%zu;\n", open[depth], ip + 1);
+
+        open[++depth] = ip + 1;
+    }
+
+    fprintf(fp, "}\n");
+    free(open);
+}
@@ -0,0 +1,22 @@
+#ifndef __REPORT_H
+#define __REPORT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "List.h"
+#include "State.h"
+
+// Write what the optimizer does to a file from now on, NULL to stop
+void Report_To(FILE *);
+// Whether a report is being written
+bool Reporting(void);
+// Note the size of the program before and after a pass
+void Report_Pass(const char *, size_t, size_t);
+// Note what a pass did with the loop starting at a token of its input
+void Report_Loop(List_t *, size_t, const char *, ...);
+// Write the size of the program after every pass, and how many tokens of each type it ends up with
+void Report_Program(List_t *);
+// Write the loop nest of a program as Graphviz DOT, with the stats of a state if it was profiled
+void Report_Dot(State_t *, FILE *);
+
+#endif
@@ -0,0 +1,373 @@
+#define _GNU_SOURCE // memfd_create
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "State.h"
+#include "Trace.h"
+#include "Memo.h"
+#include "Profile.h"
+#include "nerv.h"
+
+// Initial capacity of the input and output buffers
+#define IO_CAP 256
+
+// Tag at the start of every snapshot file
+#define SNAP_MAGIC "NERVSNAP"
+
+// Layout of a snapshot
+/*
+    +------+---------+------------------+----------------+
+    | head | padding | tape (TAPE_LEN)  | pending output |
+    +------+---------+------------------+----------------+
+                     ^
+                  tape_off, a multiple of the page size so the tape can be mapped
+
+    In memory snapshots use the same layout inside a memfd, so saving one is a copy.
+*/
+typedef struct Snap_Head
+{
+    char magic[8];
+    uint64_t prog, ptr, ip, tape_len, tape_off, out_len;
+} Snap_Head;
+
+// Bytes mapped for the tape, whole pages
+static size_t tape_span(void)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (TAPE_LEN + page - 1) / page * page;
+}
+
+// Reserve the tape with its guards and map it in the middle, from fd at off or zeroed if fd is -1
+static char *map_tape(int fd, off_t off)
+{
+    char *base = mmap(NULL, TAPE_GUARD * 2 + tape_span(), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    char *mem = mmap(base + TAPE_GUARD, tape_span(), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_FIXED | (fd < 0 ? MAP_ANONYMOUS : 0), fd, fd < 0 ? 0 : off);
+    if (mem == MAP_FAILED)
+    {
+        munmap(base, TAPE_GUARD * 2 + tape_span());
+        return NULL;
+    }
+
+    return mem;
+}
+
+bool Off_Tape(State_t *s, const void *addr)
+{
+    const char *a = addr;
+    return a >= s->mem - TAPE_GUARD && a < s->mem + tape_span() + TAPE_GUARD
+        && (a < s->mem || a >= s->mem + tape_span());
+}
+
+// Set up a state around a tape
+static State_t *state_init(List_t *tokens, char *mem)
+{
+    State_t *s = malloc(sizeof(State_t));
+    if (!s)
+    {
+        fprintf(stderr, "Could not allocate memory for the state\n");
+        exit(EXIT_FAILURE);
+    }
+
+    s->mem = mem;
+    s->in = malloc(IO_CAP);
+    s->out = malloc(IO_CAP);
+    if (!s->in || !s->out)
+    {
+        fprintf(stderr, "Could not allocate memory for the state\n");
+        exit(EXIT_FAILURE);
+    }
+
+    s->tokens = tokens;
+    s->ptr = s->ip = 0;
+    s->in_len = s->in_pos = 0;
+    s->in_cap = s->out_cap = IO_CAP;
+    s->out_len = 0;
+    s->eof = false;
+    s->hot = NULL;
+    s->memo = NULL;
+    s->prof = NULL;
+
+    return s;
+}
+
+// Constructor
+State_t *State_Cons(List_t *tokens)
+{
+    // the tape is mapped rather than malloc'd, so Restore can hand out copy-on-write tapes
+    char *mem = map_tape(-1, 0);
+    if (!mem)
+    {
+        fprintf(stderr, "Could not allocate memory for the tape\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return state_init(tokens, mem);
+}
+
+// Destructor
+void State_Destroy(State_t *s)
+{
+    munmap(s->mem - TAPE_GUARD, TAPE_GUARD * 2 + tape_span());
+    Free_Traces(s);
+    Memo_Destroy(s);
+    Profile_Disable(s);
+    free(s->in);
+    free(s->out);
+    free(s);
+}
+
+// Queue input for IN instructions
+void Feed(State_t *s, const char *buf, size_t n)
+{
+    // Drop input that has already been consumed
+    if (s->in_pos)
+    {
+        memmove(s->in, s->in + s->in_pos, s->in_len - s->in_pos);
+        s->in_len -= s->in_pos;
+        s->in_pos = 0;
+    }
+
+    if (s->in_len + n > s->in_cap)
+    {
+        while (s->in_len + n > s->in_cap)
+            s->in_cap *= 2;
+        s->in = realloc(s->in, s->in_cap);
+
+        if (!s->in)
+        {
+            fprintf(stderr, "Could not reallocate memory for the input of capacity: %zu\n", s->in_cap);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memcpy(s->in + s->in_len, buf, n);
+    s->in_len += n;
+}
+
+// Mark the input as closed
+void Close_Input(State_t *s)
+{
+    s->eof = true;
+}
+
+// Append a byte of output
+void Emit(State_t *s, char c)
+{
+    if (s->out_len == s->out_cap)
+    {
+        s->out_cap *= 2;
+        s->out = realloc(s->out, s->out_cap);
+
+        if (!s->out)
+        {
+            fprintf(stderr, "Could not reallocate memory for the output of capacity: %zu\n", s->out_cap);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    s->out[s->out_len++] = c;
+}
+
+// Append n bytes of output
+void Emit_Str(State_t *s, const char *buf, size_t n)
+{
+    if (s->out_len + n > s->out_cap)
+    {
+        while (s->out_len + n > s->out_cap)
+            s->out_cap *= 2;
+        s->out = realloc(s->out, s->out_cap);
+
+        if (!s->out)
+        {
+            fprintf(stderr, "Could not reallocate memory for the output of capacity: %zu\n", s->out_cap);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memcpy(s->out + s->out_len, buf, n);
+    s->out_len += n;
+}
+
+// Write pending output to a file and clear it
+void Drain(State_t *s, FILE *fp)
+{
+    if (s->out_len)
+        fwrite(s->out, 1, s->out_len, fp);
+    s->out_len = 0;
+}
+
+// Write all of a buffer at an offset
+static bool write_at(int fd, const void *buf, size_t n, off_t at)
+{
+    const char *p = buf;
+
+    while (n)
+    {
+        ssize_t k = pwrite(fd, p, n, at);
+        if (k <= 0)
+            return false;
+        p += k;
+        n -= k;
+        at += k;
+    }
+
+    return true;
+}
+
+// Write a snapshot in the layout above
+static bool write_snap(int fd, const Snap_t *snap, const char *tape)
+{
+    Snap_Head head;
+    memcpy(head.magic, SNAP_MAGIC, sizeof(head.magic));
+    head.prog = snap->prog;
+    head.ptr = snap->ptr;
+    head.ip = snap->ip;
+    head.tape_len = TAPE_LEN;
+    head.tape_off = snap->tape_off;
+    head.out_len = snap->out_len;
+
+    return ftruncate(fd, snap->tape_off + TAPE_LEN + snap->out_len) == 0
+        && write_at(fd, &head, sizeof(head), 0)
+        && write_at(fd, tape, TAPE_LEN, snap->tape_off)
+        && write_at(fd, snap->out, snap->out_len, snap->tape_off + TAPE_LEN);
+}
+
+// Snapshot a state
+Snap_t *Checkpoint(State_t *s)
+{
+    Snap_t *snap = malloc(sizeof(Snap_t));
+    if (!snap)
+    {
+        fprintf(stderr, "Could not allocate memory for the snapshot\n");
+        exit(EXIT_FAILURE);
+    }
+
+    snap->fd = memfd_create("nerv-snap", MFD_CLOEXEC);
+    snap->tape_off = sysconf(_SC_PAGESIZE);
+    snap->prog = Program_Hash(s->tokens);
+    snap->ptr = s->ptr;
+    snap->ip = s->ip;
+    snap->out_len = s->out_len;
+    snap->out = malloc(s->out_len + 1);
+
+    if (snap->fd < 0 || !snap->out)
+    {
+        fprintf(stderr, "Could not allocate memory for the snapshot\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(snap->out, s->out, s->out_len);
+
+    if (!write_snap(snap->fd, snap, s->mem))
+    {
+        fprintf(stderr, "Could not write the snapshot\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return snap;
+}
+
+// Start a new run of a program from a snapshot
+State_t *Restore(Snap_t *snap, List_t *tokens)
+{
+    if (snap->prog != Program_Hash(tokens) || snap->ip > len(tokens))
+        return NULL;
+
+    // private mapping, so each run only copies the pages it writes to
+    char *mem = map_tape(snap->fd, snap->tape_off);
+    if (!mem)
+    {
+        fprintf(stderr, "Could not map the snapshot's tape\n");
+        exit(EXIT_FAILURE);
+    }
+
+    State_t *s = state_init(tokens, mem);
+    s->ptr = snap->ptr;
+    s->ip = snap->ip;
+    Emit_Str(s, snap->out, snap->out_len);
+
+    return s;
+}
+
+// Write a snapshot to a file
+bool Save_Snap(Snap_t *snap, const char *path)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    char *tape = mmap(NULL, TAPE_LEN, PROT_READ, MAP_PRIVATE, snap->fd, snap->tape_off);
+    bool ok = tape != MAP_FAILED && write_snap(fd, snap, tape);
+
+    if (tape != MAP_FAILED)
+        munmap(tape, TAPE_LEN);
+    close(fd);
+
+    return ok;
+}
+
+// Read a snapshot from a file
+Snap_t *Load_Snap(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    // nothing in the head is trusted, the pointer has to be on the tape and the output in the file
+    Snap_Head head;
+    struct stat st;
+    if (pread(fd, &head, sizeof(head), 0) != sizeof(head)
+        || fstat(fd, &st)
+        || memcmp(head.magic, SNAP_MAGIC, sizeof(head.magic))
+        || head.tape_len != TAPE_LEN
+        || head.tape_off % sysconf(_SC_PAGESIZE)
+        || head.tape_off > (uint64_t)st.st_size
+        || (uint64_t)st.st_size - head.tape_off < TAPE_LEN
+        || head.out_len > (uint64_t)st.st_size - head.tape_off - TAPE_LEN
+        || head.ptr >= TAPE_LEN)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    Snap_t *snap = malloc(sizeof(Snap_t));
+    char *out = malloc(head.out_len + 1);
+    if (!snap || !out)
+    {
+        fprintf(stderr, "Could not allocate memory for the snapshot\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pread(fd, out, head.out_len, head.tape_off + TAPE_LEN) != (ssize_t)head.out_len)
+    {
+        free(snap);
+        free(out);
+        close(fd);
+        return NULL;
+    }
+
+    snap->fd = fd;
+    snap->tape_off = head.tape_off;
+    snap->prog = head.prog;
+    snap->ptr = head.ptr;
+    snap->ip = head.ip;
+    snap->out = out;
+    snap->out_len = head.out_len;
+
+    return snap;
+}
+
+// Destructor
+void Snap_Destroy(Snap_t *snap)
+{
+    close(snap->fd);
+    free(snap->out);
+    free(snap);
+}
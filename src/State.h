@@ -0,0 +1,84 @@
+#ifndef __STATE_H
+#define __STATE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "List.h"
+
+// Number of cells on the tape
+#define TAPE_LEN 30000
+// Inaccessible memory on either side of the tape, more than a program of any size that is read
+// can move the pointer between touching two cells, so running off the tape faults instead of
+// landing in some other memory
+#define TAPE_GUARD (1UL << 28)
+
+// Result of running a State for a slice of fuel
+typedef enum Status
+{
+    RUNNING, // Ran out of fuel, call Step again to continue
+    BLOCKED, // Hit an IN with no pending input, Feed the state to continue
+    HALTED,  // Ran off the end of the program
+} Status;
+
+// Everything the interpreter needs to pause and resume a program
+// The state does not own its tokens, so many states can share one compiled program
+typedef struct State_t
+{
+    List_t *tokens; // program being executed
+    char *mem;      // the tape
+    size_t ptr;     // memory pointer, as an index into the tape
+    size_t ip;      // instruction pointer
+
+    char *in;       // pending input
+    size_t in_len, in_pos, in_cap;
+    bool eof;       // no more input will be fed, IN reads EOF once in is exhausted
+
+    char *out;      // output produced since the last Drain
+    size_t out_len, out_cap;
+
+    struct Hot *hot;        // counters and compiled bodies of loops, indexed by LOOP_START, see Trace.h
+    struct Memo *memo;      // results of pure loops, NULL unless turned on, see Memo.h
+    struct Profiler *prof;  // stats on every loop and IF, NULL unless profiling, see Profile.h
+} State_t;
+
+// A paused run, saved so that later runs can start from it instead of from scratch
+typedef struct Snap_t
+{
+    int fd;          // memfd or file holding the tape, mapped copy-on-write by Restore
+    size_t tape_off; // page aligned offset of the tape in fd
+    uint64_t prog;   // hash of the program the snapshot was taken from
+    size_t ptr, ip;
+    char *out;       // output produced before the snapshot, not yet drained
+    size_t out_len;
+} Snap_t;
+
+// Constructor
+State_t *State_Cons(List_t *);
+// Destructor, does not free the tokens
+void State_Destroy(State_t *);
+// Queue input for IN instructions
+void Feed(State_t *, const char *, size_t);
+// Mark the input as closed
+void Close_Input(State_t *);
+// Append a byte of output
+void Emit(State_t *, char);
+// Append n bytes of output
+void Emit_Str(State_t *, const char *, size_t);
+// Write pending output to a file and clear it
+void Drain(State_t *, FILE *);
+// Whether an address lies in the guards around a state's tape, for telling a program that ran off it from a crash
+bool Off_Tape(State_t *, const void *);
+
+// Snapshot a state, it can keep running afterwards
+Snap_t *Checkpoint(State_t *);
+// Start a new run of a program from a snapshot, NULL if the snapshot is of another program
+State_t *Restore(Snap_t *, List_t *);
+// Write a snapshot to a file
+bool Save_Snap(Snap_t *, const char *);
+// Read a snapshot from a file, NULL if it is not a snapshot or its head is out of bounds
+Snap_t *Load_Snap(const char *);
+// Destructor
+void Snap_Destroy(Snap_t *);
+
+#endif
@@ -16,6 +16,15 @@ typedef enum Type
     COM,        // Comment
     MEM_SET,    // Set the current cell value to x
     MUL,        // Multiply cell at offset by a multiple of the cell value
+    PRINT_CONST,// Print n bytes of the list's string table, starting at offset
+    MEM_RANGE,  // Set the n cells starting at offset to aux
+    MUL_VEC,    // Add the current cell times a coefficient to each of the n cells starting at offset
+                // the coefficients are n bytes of the list's string table, starting at aux
+    COPY,       // Add the current cell to the cell at offset, move the cell at aux into it
+    CMP,        // Set the current cell to n (0 or 1) if it equals the cell at offset, !n otherwise, and clear that cell
+    DIVMOD,     // Divide the current cell by the cell 2 to the right, if the loop after it can be skipped
+    IF,         // Skip to the matching END_IF if the current cell is 0, a loop that runs at most once
+    END_IF,     // Mark the end of an IF
 } Type;
 
 // Brainfuck Token structure
@@ -25,6 +34,7 @@ typedef struct Tok
     int n;      // number of times to apply the operation (computed by run length encoding)
     int offset; // the position to offset the command
                 // in the event that the token is a loop it is the position to jump to during looping
+    int aux;    // extra operand for tokens that need one, 0 otherwise
 } Tok;
 
 #endif
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "List.h"
+#include "Kernel.h"
+#include "Trace.h"
+
+/*
+    Superblocks for hot loops
+
+    The interpreter pays for a dispatch on every token, and an inner loop like
+
+        [->>+<<<+>]
+
+    dispatches 6 tokens per iteration, SHR and SHL included. Once a loop has been entered
+    TRACE_HOT times its body is decoded into a trace: the moves are folded into the cell
+    each operation touches, so the pointer stays on the loop cell and the only check left
+    is the loop condition, once per iteration.
+
+        SUB(1) SHR(2) SUM(1) SHL(3) SUM(1) SHR(1)   =>   +255 @0, +1 @2, +1 @-1
+
+    An IF in the body becomes an op that skips the ops of its body if its cell is 0.
+    Nothing is folded across the end of an IF, the op before it may not have run.
+
+    Only innermost loops that leave the pointer where they found it and do no I/O are traced,
+    anything else keeps going through the interpreter until it is hot enough for the JIT.
+*/
+
+// Decode the body of the loop starting at ip, NULL if it can't be traced
+static Trace *build(List_t *tokens, size_t ip)
+{
+    size_t end = tokens->data[ip]->offset;
+    int at = 0;
+
+    Trace *tr = malloc(sizeof(Trace));
+    Op *ops = malloc(sizeof(Op) * (end - ip));
+    size_t *open = malloc(sizeof(size_t) * (end - ip));
+    if (!tr || !ops || !open)
+    {
+        fprintf(stderr, "Could not allocate memory for a trace\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // ops below base can't be folded into, depth IFs are open
+    size_t n = 0, base = 0, depth = 0;
+    for (size_t i = ip + 1; i < end; ++i)
+    {
+        Tok *t = tokens->data[i];
+
+        switch (t->flag)
+        {
+            case SHR:
+                at += t->n;
+                break;
+            case SHL:
+                at -= t->n;
+                break;
+            case SUM:
+            case SUB:
+            {
+                unsigned char v = t->flag == SUM ? t->n : -t->n;
+
+                // fold into the last op if it touches the same cell
+                if (n > base && ops[n - 1].at == at && (ops[n - 1].flag == SUM || ops[n - 1].flag == MEM_SET))
+                    ops[n - 1].n = (unsigned char)(ops[n - 1].n + v);
+                else
+                    ops[n++] = (Op){SUM, at, v, 0, NULL};
+                break;
+            }
+            case MEM_SET:
+                if (n > base && ops[n - 1].at == at && (ops[n - 1].flag == SUM || ops[n - 1].flag == MEM_SET))
+                    n--;
+                ops[n++] = (Op){MEM_SET, at, (unsigned char)t->n, 0, NULL};
+                break;
+            case MUL:
+                ops[n++] = (Op){MUL, at, t->n, t->offset, NULL};
+                break;
+            case MEM_RANGE:
+                ops[n++] = (Op){MEM_RANGE, at + t->offset, t->n, t->aux, NULL};
+                break;
+            case MUL_VEC:
+                ops[n++] = (Op){MUL_VEC, at, t->n, t->offset, (unsigned char *)tokens->strs + t->aux};
+                break;
+            case COPY:
+                ops[n++] = (Op){COPY, at, t->aux, t->offset, NULL};
+                break;
+            case CMP:
+                ops[n++] = (Op){CMP, at, t->n, t->offset, NULL};
+                break;
+            case IF:
+                open[depth++] = n;
+                ops[n++] = (Op){IF, at, 0, 0, NULL};
+                base = n;
+                break;
+            case END_IF:
+            {
+                // the body of an IF is balanced, so at is back on its cell
+                size_t k = open[--depth];
+                ops[k].n = n - k - 1;
+                base = n;
+                break;
+            }
+            case COM:
+                break;
+            default:
+                // I/O, a nested loop, or a DIVMOD, which is always followed by its guarded loop anyway
+                free(open);
+                free(ops);
+                free(tr);
+                return NULL;
+        }
+    }
+
+    free(open);
+
+    // the pointer has to be back on the loop cell to check the condition
+    if (at)
+    {
+        free(ops);
+        free(tr);
+        return NULL;
+    }
+
+    tr->ops = ops;
+    tr->len = n;
+    tr->cost = end - ip + 1;
+    return tr;
+}
+
+Hot *Hot_Loop(State_t *s, size_t ip)
+{
+    if (!s->hot)
+    {
+        s->hot = calloc(len(s->tokens), sizeof(Hot));
+        if (!s->hot)
+        {
+            fprintf(stderr, "Could not allocate memory for loop counters\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    Hot *h = &s->hot[ip];
+    if (h->hits >= JIT_HOT)
+        return h;
+
+    h->hits++;
+    if (h->hits == TRACE_HOT)
+        h->trace = build(s->tokens, ip);
+    else if (h->hits == JIT_HOT)
+        h->native = Jit_Compile(s->tokens, ip);
+
+    return h;
+}
+
+size_t Run_Trace(Trace *tr, char *ptr, size_t fuel)
+{
+    while (*ptr && fuel >= tr->cost)
+    {
+        fuel -= tr->cost;
+
+        for (Op *op = tr->ops, *end = tr->ops + tr->len; op < end; ++op)
+        {
+            char *cell = ptr + op->at;
+
+            switch (op->flag)
+            {
+                case SUM:
+                    *cell += op->n;
+                    break;
+                case MEM_SET:
+                    *cell = op->n;
+                    break;
+                case MUL:
+                    if (*cell)
+                        *(cell + op->offset) += *cell * op->n;
+                    break;
+                case MEM_RANGE:
+                    Set_Range(cell, op->offset, op->n);
+                    break;
+                case MUL_VEC:
+                    if (*cell)
+                        Mul_Vec(cell + op->offset, op->coef, *cell, op->n);
+                    break;
+                case COPY:
+                    if (*cell)
+                        *(cell + op->offset) += *cell;
+                    *cell += *(cell + op->n);
+                    *(cell + op->n) = 0;
+                    break;
+                case CMP:
+                    *cell = *cell == *(cell + op->offset) ? op->n : !op->n;
+                    *(cell + op->offset) = 0;
+                    break;
+                case IF:
+                    if (!*cell)
+                        op += op->n;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    return fuel;
+}
+
+void Free_Traces(State_t *s)
+{
+    if (!s->hot)
+        return;
+
+    for (size_t i = 0; i < len(s->tokens); ++i)
+    {
+        Hot *h = &s->hot[i];
+
+        if (h->trace)
+        {
+            free(h->trace->ops);
+            free(h->trace);
+        }
+        if (h->native)
+            Native_Destroy(h->native);
+    }
+
+    free(s->hot);
+}
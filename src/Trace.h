@@ -0,0 +1,53 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stddef.h>
+#include "Token.h"
+#include "State.h"
+#include "Jit.h"
+
+// Number of times a loop is entered before its body is compiled into a trace
+#define TRACE_HOT 64
+
+// A pre-decoded operation of a trace
+// the pointer never moves inside a trace, so every cell is addressed relative to the loop cell
+typedef struct Op
+{
+    Type flag;   // SUM, MEM_SET, MUL, MEM_RANGE, MUL_VEC, COPY, CMP or IF
+    int at;      // cell the operation is applied at
+    int n;       // value, factor or window length, temp cell of a COPY relative to at, ops an IF skips
+    int offset;  // target of a MUL, MUL_VEC, COPY or CMP relative to at, value of a MEM_RANGE
+    const unsigned char *coef; // coefficients of a MUL_VEC
+} Op;
+
+// The body of a loop as one straight line of operations
+typedef struct Trace
+{
+    Op *ops;
+    size_t len;
+    size_t cost; // tokens the interpreter would run for one iteration
+} Trace;
+
+// What the interpreter knows about a loop, indexed by its LOOP_START
+/*
+    Loops move up a tier the more often they are entered
+
+        cold       interpreted token by token
+        TRACE_HOT  innermost loops without I/O run as a trace
+        JIT_HOT    loops without I/O run as machine code
+*/
+typedef struct Hot
+{
+    unsigned hits;  // times the loop was entered, counting stops at JIT_HOT
+    Trace *trace;   // NULL until TRACE_HOT, or if the body can't be traced
+    Native *native; // NULL until JIT_HOT, or if the loop can't be compiled
+} Hot;
+
+// Count an entry into the loop starting at ip, moving it up a tier when it gets hot enough
+Hot *Hot_Loop(State_t *, size_t);
+// Run whole iterations of a trace while fuel lasts, returns the fuel left
+size_t Run_Trace(Trace *, char *, size_t);
+// Free every trace and native loop of a state
+void Free_Traces(State_t *);
+
+#endif
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+    A test client for nerv --serve
+
+    Sends a program (or the hash of one the server has already compiled) with
+    everything read from stdin as its input, and prints the program's output.
+*/
+
+const char *USAGE = "usage: client <socket> <file> [-O0,-O1,-O2]\n"
+                    "       client <socket> --hash <hash> [-O0,-O1,-O2]\n";
+
+#define CHUNK 4096
+
+// Read a whole stream into a malloc'd buffer
+char *slurp(FILE *fp, size_t *n)
+{
+    size_t cap = CHUNK, k;
+    char *buf = malloc(cap);
+    *n = 0;
+
+    while (buf && (k = fread(buf + *n, 1, cap - *n, fp)) > 0)
+    {
+        *n += k;
+        if (*n == cap)
+            buf = realloc(buf, cap *= 2);
+    }
+
+    if (!buf)
+    {
+        fprintf(stderr, "Could not allocate memory for the request\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return buf;
+}
+
+// Send a whole buffer
+void send_all(int fd, const char *buf, size_t n)
+{
+    while (n)
+    {
+        ssize_t k = write(fd, buf, n);
+        if (k < 0)
+        {
+            perror("write");
+            exit(EXIT_FAILURE);
+        }
+        buf += k;
+        n -= k;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "%s", USAGE);
+        exit(EXIT_FAILURE);
+    }
+
+    int by_hash = !strcmp(argv[2], "--hash");
+    if (by_hash && argc < 4)
+    {
+        fprintf(stderr, "%s", USAGE);
+        exit(EXIT_FAILURE);
+    }
+
+    const char *flag = argc > 3 + by_hash ? argv[3 + by_hash] : "-O2";
+    int opt = (strlen(flag) == 3 && flag[2] >= '0' && flag[2] <= '2') ? flag[2] - '0' : 2;
+
+    char *program = NULL;
+    size_t prog_len = 0;
+    if (!by_hash)
+    {
+        FILE *fp = fopen(argv[2], "r");
+        if (!fp)
+        {
+            fprintf(stderr, "Could not open %s!\n", argv[2]);
+            exit(EXIT_FAILURE);
+        }
+        program = slurp(fp, &prog_len);
+        fclose(fp);
+    }
+
+    size_t in_len = 0;
+    char *input = isatty(STDIN_FILENO) ? calloc(1, 1) : slurp(stdin, &in_len);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    char head[128];
+    int n;
+    if (by_hash)
+        n = snprintf(head, sizeof(head), "HASH %s %d %zu\n", argv[3], opt, in_len);
+    else
+        n = snprintf(head, sizeof(head), "RUN %d %zu %zu\n", opt, prog_len, in_len);
+
+    send_all(fd, head, n);
+    send_all(fd, program, prog_len);
+    send_all(fd, input, in_len);
+    shutdown(fd, SHUT_WR);
+
+    // the reply line goes to stderr, the program's output to stdout
+    char buf[CHUNK];
+    ssize_t k;
+    int status = EXIT_SUCCESS;
+    int in_head = 1;
+    while ((k = read(fd, buf, CHUNK)) > 0)
+    {
+        ssize_t i = 0;
+        if (in_head)
+        {
+            while (i < k && buf[i] != '\n')
+                ++i;
+            if (i < k)
+            {
+                in_head = 0;
+                ++i;
+            }
+            fwrite(buf, 1, i, stderr);
+            if (!strncmp(buf, "ERR", 3))
+                status = EXIT_FAILURE;
+        }
+        fwrite(buf + i, 1, k - i, stdout);
+    }
+
+    close(fd);
+    free(program);
+    free(input);
+
+    return status;
+}
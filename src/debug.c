@@ -3,11 +3,14 @@
 #include <time.h>
 #include "nerv.h"
 
-#define TESTS 17
+#define TESTS 25
 
 const char *tests[TESTS] = {"--++", "--+++", "++++++--[->+<]", "+++--", "+--", ">><<", "[->+<][+++++>+++++>+++>++<-]",
         "[->+<]", "[->++<]", "[->++>+<<]", "[>+<-]", "[-]", "[+]", "[->++>+++>++++<<<][-]+++--", "[->++>+<<<+>]",
-        "[<<+>>-]", "[+++++++++.[-]+++++++++[<++++++++>-]]"};
+        "[<<+>>-]", "[+++++++++.[-]+++++++++[<++++++++>-]]",
+        ",[>[-]>[-]>[-]>[-]<<<<-]", ",[->+>++>+++>++++<<<<]", ",[->+++<]>.>++[-]<<+",
+        ",[->+>+<<]>>[-<<+>>]<<", ",>,<[->-<]+>[<->[-]]<", ",>>,<<[->+>-[>+>>]>[+[-<+>]>+>>]<<<<<<]",
+        ",[>+<[-]]>.", ",[>,[>+<[-]]<[-]]>>."};
 
 void run(const char *p)
 {
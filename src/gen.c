@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Gen.h"
+
+/*
+    Writes a synthetic program, its input and its expected output, see Gen.c
+
+        gen prog --len 100000 --depth 4
+        ./nerv prog.bf -O2 < prog.in | cmp - prog.out
+*/
+
+const char *USAGE = "usage: gen <name> [--len n] [--depth n] [--mul w] [--scan w] [--clear w] [--io w] [--span n] [--seed n]\n"
+                    "       writes <name>.bf, <name>.in and <name>.out, what it prints at O0 given <name>.in\n";
+
+static void write_file(const char *name, const char *ext, const char *data, size_t n)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s%s", name, ext);
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp || fwrite(data, 1, n, fp) != n)
+    {
+        fprintf(stderr, "Could not write %s!\n", path);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fp);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc % 2)
+    {
+        fprintf(stderr, "%s", USAGE);
+        exit(EXIT_FAILURE);
+    }
+
+    Gen g = GEN_DEFAULTS;
+    for (int i = 2; i < argc; i += 2)
+    {
+        const char *flag = argv[i];
+        long v = atol(argv[i + 1]);
+
+        if (!strcmp(flag, "--len"))
+            g.len = v;
+        else if (!strcmp(flag, "--depth"))
+            g.depth = v;
+        else if (!strcmp(flag, "--mul"))
+            g.mul = v;
+        else if (!strcmp(flag, "--scan"))
+            g.scan = v;
+        else if (!strcmp(flag, "--clear"))
+            g.clear = v;
+        else if (!strcmp(flag, "--io"))
+            g.io = v;
+        else if (!strcmp(flag, "--span"))
+            g.span = v;
+        else if (!strcmp(flag, "--seed"))
+            g.seed = v;
+        else
+        {
+            fprintf(stderr, "%s", USAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    char *in;
+    size_t in_len, n;
+    char *prog = Generate(&g, &in, &in_len);
+    char *out = Expected(prog, in, in_len, &n);
+
+    write_file(argv[1], ".bf", prog, strlen(prog));
+    write_file(argv[1], ".in", in, in_len);
+    write_file(argv[1], ".out", out, n);
+
+    free(prog);
+    free(in);
+    free(out);
+}
@@ -2,14 +2,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include "nerv.h"
+#include "Memo.h"
+#include "Report.h"
+#include "Profile.h"
 
 /*
     A Brainfuck Interpreter using the Nerv API
 */
 
-const char *USAGE = "usage: nerv <file> <-[O0,O1,O2]>";
+const char *USAGE = "usage: nerv <file> <-[O0,O1,O2]> [--checkpoint <snapshot> | --restore <snapshot> | --memo | --report <dot>\n"
+                    "                                 | --profile <profile> | --use-profile <profile> [--compile <c file>]\n"
+                    "                                 | --compile <c file>]\n"
+                    "       nerv --serve <socket>\n";
 
-#define FB_SIZE 90000
+#define CHECKPOINT_SLICE 90000   // tokens --checkpoint runs between checks for the first IN
+#define SRC_SIZE (1 << 26)         // largest program that can be read
 
 Opt getop(char* arg)
 {
@@ -31,6 +38,13 @@ Opt getop(char* arg)
 
 int main(int argc, char *argv[])
 {
+    // run as a program server
+    if (argc == 3 && !strcmp(argv[1], "--serve"))
+    {
+        nerv_serve(argv[2]);
+        return 0;
+    }
+
     // no args provided
     if (argc < 3)
     {
@@ -39,8 +53,8 @@ int main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
-    char buffer[FB_SIZE];
-    if (!Read_BF(argv[1], buffer, FB_SIZE))
+    static char buffer[SRC_SIZE];
+    if (!Read_BF(argv[1], buffer, SRC_SIZE))
     {
         fprintf(stderr, "Could not open %s!\n", argv[1]);
         exit(EXIT_FAILURE);
@@ -49,5 +63,151 @@ int main(int argc, char *argv[])
     // get optimization level
     Opt op = getop(argv[2]);
 
-    nerv(buffer, op);
+    if (argc < 4)
+    {
+        nerv(buffer, op);
+        return 0;
+    }
+
+    // the report is written while the program compiles
+    if (argc == 5 && !strcmp(argv[3], "--report"))
+        Report_To(stderr);
+
+    // and the profile is used while it compiles
+    Profile *use = NULL;
+    if ((argc == 5 || argc == 7) && !strcmp(argv[3], "--use-profile"))
+    {
+        use = Load_Profile(argv[4]);
+        if (!use)
+        {
+            fprintf(stderr, "Could not read profile %s!\n", argv[4]);
+            exit(EXIT_FAILURE);
+        }
+        if (use->prog != Hash(buffer, strlen(buffer)))
+        {
+            fprintf(stderr, "%s is a profile of a different program!\n", argv[4]);
+            exit(EXIT_FAILURE);
+        }
+        Use_Profile(use);
+    }
+
+    // write the program out as C instead of running it
+    const char *c_path = NULL;
+    if (argc == 5 && !strcmp(argv[3], "--compile"))
+        c_path = argv[4];
+    else if (argc == 7 && use && !strcmp(argv[5], "--compile"))
+        c_path = argv[6];
+    else if (argc > 5)
+    {
+        fprintf(stderr, USAGE);
+        exit(EXIT_FAILURE);
+    }
+
+    if (c_path)
+    {
+        nervc(buffer, c_path, op);
+        Use_Profile(NULL);
+        Profile_Destroy(use);
+        return 0;
+    }
+
+    List_t *tokens = Lexer(buffer, op);
+    State_t *s;
+
+    if (argc == 4 && !strcmp(argv[3], "--memo"))
+    {
+        s = State_Cons(tokens);
+        Memo_Enable(s);
+        Run(s);
+        Memo_Stats(s, stderr);
+    }
+    else if (argc < 5)
+    {
+        fprintf(stderr, USAGE);
+        exit(EXIT_FAILURE);
+    }
+    else if (!strcmp(argv[3], "--checkpoint"))
+    {
+        // run the input independent part of the program, up to its first IN
+        s = State_Cons(tokens);
+        while (Step(s, CHECKPOINT_SLICE) == RUNNING)
+            ;
+
+        Snap_t *snap = Checkpoint(s);
+        if (!Save_Snap(snap, argv[4]))
+        {
+            fprintf(stderr, "Could not write snapshot %s!\n", argv[4]);
+            exit(EXIT_FAILURE);
+        }
+        Snap_Destroy(snap);
+    }
+    else if (!strcmp(argv[3], "--report"))
+    {
+        FILE *dot = fopen(argv[4], "w");
+        if (!dot)
+        {
+            fprintf(stderr, "Could not write %s!\n", argv[4]);
+            exit(EXIT_FAILURE);
+        }
+
+        // profile every loop as the program runs, then draw the loop nest with the counts
+        s = State_Cons(tokens);
+        Profile_Enable(s);
+        Run(s);
+        Report_Dot(s, dot);
+
+        fclose(dot);
+        Report_To(NULL);
+    }
+    else if (!strcmp(argv[3], "--profile"))
+    {
+        s = State_Cons(tokens);
+        Profile_Enable(s);
+        Run(s);
+
+        Profile *pr = Take_Profile(s, Hash(buffer, strlen(buffer)));
+        if (!Save_Profile(pr, argv[4]))
+        {
+            fprintf(stderr, "Could not write profile %s!\n", argv[4]);
+            exit(EXIT_FAILURE);
+        }
+        Profile_Destroy(pr);
+    }
+    else if (!strcmp(argv[3], "--use-profile"))
+    {
+        // the hot loops are ready before the first iteration
+        s = State_Cons(tokens);
+        Profile_Warm(s);
+        Run(s);
+
+        Use_Profile(NULL);
+        Profile_Destroy(use);
+    }
+    else if (!strcmp(argv[3], "--restore"))
+    {
+        Snap_t *snap = Load_Snap(argv[4]);
+        if (!snap)
+        {
+            fprintf(stderr, "Could not read snapshot %s!\n", argv[4]);
+            exit(EXIT_FAILURE);
+        }
+
+        s = Restore(snap, tokens);
+        if (!s)
+        {
+            fprintf(stderr, "%s is a snapshot of a different program!\n", argv[4]);
+            exit(EXIT_FAILURE);
+        }
+        Snap_Destroy(snap);
+
+        Run(s);
+    }
+    else
+    {
+        fprintf(stderr, USAGE);
+        exit(EXIT_FAILURE);
+    }
+
+    State_Destroy(s);
+    Destroy(tokens);
 }
\ No newline at end of file
@@ -1,30 +1,69 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <assert.h>
 #include "List.h"
 #include "Token.h"
 #include "Opt.h"
+#include "Kernel.h"
+#include "Trace.h"
+#include "Memo.h"
+#include "Par.h"
+#include "Report.h"
+#include "Profile.h"
 #include "nerv.h"
 
 // Constants
 #define USE_GETC 0
-#define TAPE_LEN 30000
 #define BUFFER_SIZE 4096 // num of bytes to read before writting to a file
+#define MAX_LINE 128     // longest line nervc writes to its buffer, tabs aside
+#define MAX_INDENT 64    // most tabs nervc indents a line by
 #define CAP_OUT 1        // whether or not to output interpreter output to tmp.out
 #define PASSES 2         // number of passes the optimizer will run
+#define FUEL (1 << 20)   // number of tokens nerv runs between flushing output
+#define USE_TRACES 1     // whether or not hot loops are run as traces
+#define USE_JIT 1        // whether or not hot loops are compiled to machine code
 
 // Lookup table to print enum values as strings
-const char *Flag_LT[11] = {"Sum", "Sub", "Loop_Start", "Loop_End", "SHR", "SHL", "OUT", "IN", "COM", "MEM_SET", "MUL"};
+const char *Flag_LT[19] = {"Sum", "Sub", "Loop_Start", "Loop_End", "SHR", "SHL", "OUT", "IN", "COM", "MEM_SET", "MUL", "PRINT_CONST",
+                           "MEM_RANGE", "MUL_VEC", "COPY", "CMP", "DIVMOD", "IF", "END_IF"};
 
 // Lookup table used by the Optimizer to tell if two tokens cancel one another out
 // if the tokens cannot be canceled out, it stores the same token type
-const Type CANCEL_LT[11] = {SUB, SUM, LOOP_START, LOOP_END, SHL, SHR, OUT, IN, COM, MEM_SET, MUL};
+const Type CANCEL_LT[19] = {SUB, SUM, LOOP_START, LOOP_END, SHL, SHR, OUT, IN, COM, MEM_SET, MUL, PRINT_CONST, MEM_RANGE, MUL_VEC,
+                            COPY, CMP, DIVMOD, IF, END_IF};
 
 // Lookup table used by the Optimizer to convert token types to chars
 // used for peephole optimization
-const char OP_LT[11] = {'+', '-', '[', ']', '>', '<', '.', ',', ' ', ' ', ' '};
+const char OP_LT[19] = {'+', '-', '[', ']', '>', '<', '.', ',', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '};
+
+// FNV-1a hash, used to identify programs by their contents
+uint64_t Hash(const void *p, size_t n)
+{
+    const unsigned char *s = p;
+    uint64_t h = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        h ^= s[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+// Hash a compiled program, used to tie snapshots to the program they came from
+uint64_t Program_Hash(List_t *tokens)
+{
+    uint64_t h = Hash(NULL, 0);
+
+    for (size_t i = 0; i < len(tokens); ++i)
+        h = (h ^ Hash(tokens->data[i], sizeof(Tok))) * 1099511628211ULL;
+
+    return (h ^ Hash(tokens->strs, tokens->strs_len)) * 1099511628211ULL;
+}
 
 // basic pre-processing
 void pproc(char *s)
@@ -72,7 +111,7 @@ bool Read_BF(const char *p, char *buff, size_t buffer_size)
             exit(EXIT_FAILURE);
         }
 
-        program = malloc(sizeof(char) * size);
+        program = malloc(sizeof(char) * (size + 1));
         if (!program)
         {
             fprintf(stderr, "Could not allocate memory for program\n");
@@ -127,25 +166,28 @@ void print_tokens(List_t *tokens, size_t start_, size_t end_)
     for (size_t i = start_; i < end_; ++i)
     {
         t = tokens->data[i];
-        printf("Token %d | %s, n:= %d, offset:= %d\n", i, Flag_LT[t->flag], t->n, t->offset);
+        printf("Token %d | %s, n:= %d, offset:= %d", i, Flag_LT[t->flag], t->n, t->offset);
+        if (t->aux)
+            printf(", aux:= %d", t->aux);
+        putchar('\n');
     }
 }
 
 // Helper function to ensure that incoming expressions have well formed loops
 bool validate_loops(const char *prog)
 {
-    size_t l, r;
-    l = r = 0;
-
-    const char *tmp = prog;
+    long depth = 0;
 
-    do
+    for (const char *tmp = prog; *tmp != '\0'; ++tmp)
     {
-        l += (*tmp == ']');
-        r += (*tmp == '[');
-    } while (*(tmp++) != '\0');
+        depth += (*tmp == '[') - (*tmp == ']');
+
+        // a ] with no matching [
+        if (depth < 0)
+            return false;
+    }
 
-    return l == r;
+    return depth == 0;
 }
 
 // Convert Brainfuck Code to a set of Tokens
@@ -191,17 +233,17 @@ void Comp_Loops(List_t *Tokens)
     for (size_t i = 0; i < len(Tokens); ++i)
     {
         Tok *token = Tokens->data[i];
-        if (token->flag != LOOP_START)
+        if (token->flag != LOOP_START && token->flag != IF)
             continue;
 
-        // Scan ahead for next matching loop end token
+        // Scan ahead for next matching loop end token, IFs nest the same way loops do
         int count, scan;
         count = scan = 1;
         while (count)
         {
             assert(i + scan < len(Tokens));
             Type tmp = (Tokens->data[i + scan])->flag;
-            count += (tmp == LOOP_START) - (tmp == LOOP_END);
+            count += (tmp == LOOP_START || tmp == IF) - (tmp == LOOP_END || tmp == END_IF);
             scan++;
         }
         token->offset = scan + i - 1;
@@ -223,16 +265,18 @@ inline bool returns_to_start(List_t *tokens, Tok *loop, size_t start)
     return position == start;
 }
 
-// id multiplication loops
-bool is_mul(List_t *tokens, Tok *loop, size_t start)
+// id multiplication loops, NULL if the loop is one and why it isn't otherwise
+// the loop cell must go down by exactly 1 each iteration, and at least one other cell must change
+const char *not_mul(List_t *tokens, Tok *loop, size_t start)
 {
-    Tok *scn = tokens->data[start + 1];
-    Tok *end = tokens->data[loop->offset-1];
-    bool dec = (scn->flag==SUB && scn->n==1) || (end->flag==SUB && end->n==1);
     bool returns = returns_to_start(tokens, loop, start);
     bool moves = false;
     bool modifies = false;
 
+    // net change of the loop cell per iteration
+    long position = 0;
+    int dec = 0;
+
     for (size_t ix = 1; ix < loop->offset - start; ++ix)
     {
         Tok *scn = tokens->data[start + ix];
@@ -241,22 +285,43 @@ bool is_mul(List_t *tokens, Tok *loop, size_t start)
         {
             case SHR:
                 moves = true;
+                position += scn->n;
                 break;
             case SHL:
                 moves = true;
+                position -= scn->n;
                 break;
             case SUM:
-                modifies = true;
+                if (position)
+                    modifies = true;
+                else
+                    dec += scn->n;
                 break;
             case SUB:
-                modifies = true;
+                if (position)
+                    modifies = true;
+                else
+                    dec -= scn->n;
                 break;
+            case LOOP_START:
+                return "it has a nested loop";
             default:
-                return false;
+                return "it does I/O";
         }
     }
 
-    return dec && returns && moves && modifies;
+    if (!returns)
+        return "it doesn't come back to the cell it started on";
+    if (dec != -1)
+        return "its cell doesn't go down by exactly 1 (no SUB 1)";
+    if (!moves || !modifies)
+        return "it changes no other cell";
+    return NULL;
+}
+
+bool is_mul(List_t *tokens, Tok *loop, size_t start)
+{
+    return !not_mul(tokens, loop, start);
 }
 
 // More complex loop unrolling
@@ -286,11 +351,18 @@ bool is_mul(List_t *tokens, Tok *loop, size_t start)
 */
 List_t *Optimizer(List_t *tokens)
 {
+    // nothing to optimize
+    if (len(tokens) == 0)
+        return tokens;
+
     List_t *opt = Cons(250);
 
     Tok *t, *scn, *opt_tok, *loop, *unroll;
     t = scn = opt_tok = loop = unroll = NULL;
 
+    // stands in for the token after the last one
+    Tok end = {COM, 0, 0, 0};
+
     bool canceled = false;
 
     // used when computing distance from start of loop
@@ -299,13 +371,15 @@ List_t *Optimizer(List_t *tokens)
 
     // used during loop unrolling
     int offset = 0;
-    // multiple of cell val
-    int mult = 0;
+    size_t muls;
 
-    for (size_t i = 0; i < len(tokens) - 1; ++i)
+    // why a loop wasn't unrolled, for the report
+    const char *why;
+
+    for (size_t i = 0; i < len(tokens); ++i)
     {
         t = tokens->data[i];
-        scn = tokens->data[i + 1];
+        scn = i + 1 < len(tokens) ? tokens->data[i + 1] : &end;
 
         opt_tok = malloc(sizeof(Tok));
         memcpy(opt_tok, t, sizeof(Tok));
@@ -335,6 +409,7 @@ List_t *Optimizer(List_t *tokens)
                 // it is therefore dead code and can be removed
                 if (scn->flag == LOOP_START)
                 {
+                    Report_Loop(tokens, i + 1, "removed, it starts right after a loop so its cell is 0");
                     i = scn->offset;
                     scn->n = 0;
                 }
@@ -350,15 +425,19 @@ List_t *Optimizer(List_t *tokens)
                     
 
                 */
-                if (!is_mul(tokens, t, i))
+                if ((why = not_mul(tokens, t, i)))
                 {
                     // check for MEM_SET
-                    if ((scn->flag == SUB || scn->flag == SUM) && i+2==t->offset)
+                    // only an odd step is sure to reach 0
+                    if ((scn->flag == SUB || scn->flag == SUM) && i+2==t->offset && scn->n % 2)
                     {
+                        Report_Loop(tokens, i, "cleared, MEM_SET(0)");
+
                         unroll = malloc(sizeof(Tok));
                         unroll->flag = MEM_SET;
                         unroll->n = 0;
                         unroll->offset = 0;
+                        unroll->aux = 0;
 
                         Append(opt, unroll);
 
@@ -366,13 +445,17 @@ List_t *Optimizer(List_t *tokens)
                         scn->n = 0;
                         opt_tok->n = 0;
                     }
+                    else
+                        Report_Loop(tokens, i, "kept, %s", why);
                     break;
                 }
 
                 // distance to end of loop
                 dist = t->offset - i;
+                offset = 0;
+                muls = len(opt);
 
-                for (size_t k = 1; k < dist-1; ++k)
+                for (size_t k = 1; k < dist; ++k)
                 {
                     loop = tokens->data[i + k];
 
@@ -385,29 +468,18 @@ List_t *Optimizer(List_t *tokens)
                             offset -= loop->n;
                             break;
                         case SUB:
-                            if (k==1)
+                        case SUM:
+                            // the loop counter, it is cleared below
+                            if (!offset)
                                 break;
 
-                            mult -= loop->n;
-                            unroll = malloc(sizeof(Tok));
-                            unroll->flag = MUL;
-                            unroll->offset = offset;
-                            unroll->n = mult;
-
-                            Append(opt, unroll);
-
-                            mult = 0;
-                            break;
-                        case SUM:
-                            mult += loop->n;
                             unroll = malloc(sizeof(Tok));
                             unroll->flag = MUL;
                             unroll->offset = offset;
-                            unroll->n = mult;
+                            unroll->n = loop->flag == SUM ? loop->n : -loop->n;
+                            unroll->aux = 0;
 
                             Append(opt, unroll);
-
-                            mult = 0;
                             break;
                         default:
                             break;
@@ -415,21 +487,18 @@ List_t *Optimizer(List_t *tokens)
 
                 }
 
-                if (unroll->n)
-                {
-                    i = t->offset-1;
-                    tokens->data[t->offset]->n = 0;
-                    opt_tok->n = 0;
-                    scn->n = 0;
-                    offset = 0;
+                Report_Loop(tokens, i, "unrolled into %zu MUL%s", len(opt) - muls, len(opt) - muls == 1 ? "" : "s");
 
-                    unroll = malloc(sizeof(Tok));
-                    unroll->flag = MEM_SET;
-                    unroll->offset = unroll->n = 0;
+                i = t->offset-1;
+                tokens->data[t->offset]->n = 0;
+                opt_tok->n = 0;
+                scn->n = 0;
 
-                    Append(opt, unroll);
-                }
-            
+                unroll = malloc(sizeof(Tok));
+                unroll->flag = MEM_SET;
+                unroll->offset = unroll->n = unroll->aux = 0;
+
+                Append(opt, unroll);
                 break;
             default:
                 break;
@@ -441,11 +510,6 @@ List_t *Optimizer(List_t *tokens)
             free(opt_tok);
     }
 
-    opt_tok = malloc(sizeof(Tok));
-    memcpy(opt_tok, scn, sizeof(Tok));
-    if (opt_tok->n)
-        Append(opt, opt_tok);
-
     Comp_Loops(opt);
 
     free(tokens);
@@ -469,23 +533,22 @@ List_t *Optimizer(List_t *tokens)
         p := program to tokenize
         opt := optimization level
 
+    Sources of PAR_LEX_MIN bytes or more are split up and lexed on several threads (see Par.c).
+
 */
-List_t *Lexer(const char *p, Opt opt)
+void Lex_Range(const char *p, size_t lo, size_t hi, Opt opt, List_t *Tokens)
 {
-    List_t *Tokens = Cons(50);
-
-    size_t ip, ln;
-    ip = 0;
-    ln = strlen(p);
+    size_t ip = lo;
+    int loops = 0;
 
     Tok *t;
 
     char c;
 
-    while (ip < ln)
+    while (ip < hi)
     {
         t = malloc(sizeof(Tok));
-        t->offset = 0;
+        t->offset = t->aux = 0;
         t->n = 1;
 
         c = p[ip];
@@ -515,6 +578,8 @@ List_t *Lexer(const char *p, Opt opt)
                 break;
             case '[':
                 t->flag = LOOP_START;
+                // number loops in source order, so profiles can find them again after optimization
+                t->aux = ++loops;
                 break;
             default:
                 t->flag = COM;
@@ -524,9 +589,11 @@ List_t *Lexer(const char *p, Opt opt)
         // perform peephole optimization if opt level greater than or equal to O1
         if (opt >= O1 && strchr("><+-", c))
         {
-            while (p[++ip] == c)
+            while (ip + 1 < hi && p[ip + 1] == c)
+            {
                 t->n++;
-            ip--;
+                ip++;
+            }
         }
 
         ip++;
@@ -537,41 +604,86 @@ List_t *Lexer(const char *p, Opt opt)
         else
             Append(Tokens, t);
     }
+}
 
-    // Compute loop offsets
-    Comp_Loops(Tokens);
+// Run a pass, noting the size of the program before and after for the report
+static List_t *pass(const char *name, List_t *(*fn)(List_t *), List_t *tokens)
+{
+    size_t before = len(tokens);
 
-    // if opt level is O2, run the optimizer
-    if (opt == O2) 
-        return Optimizer(Tokens);       
+    tokens = fn(tokens);
+    Report_Pass(name, before, len(tokens));
 
-    return Tokens;
+    return tokens;
 }
 
-
-// Basic interpreter
-void nerv(const char *p, Opt o)
+List_t *Lexer(const char *p, Opt opt)
 {
-#if CAP_OUT
-    FILE *output = fopen("./tmp.out", "w");
+    size_t ln = strlen(p);
+    List_t *Tokens;
 
-    if (!output)
+    if (Par_Threads() > 1 && ln >= PAR_LEX_MIN)
+        Tokens = Par_Lex(p, ln, opt);
+    else
     {
-        fprintf(stderr, "Could not output to tmp.out!\n");
-        exit(EXIT_FAILURE);
+        Tokens = Cons(50);
+        Lex_Range(p, 0, ln, opt, Tokens);
+
+        // Compute loop offsets
+        Comp_Loops(Tokens);
     }
-#endif
 
-    List_t *tokens = Lexer(p, o);
+    Report_Pass("Lexer", ln, len(Tokens));
+
+    // if opt level is O2, run the optimizer
+    if (opt == O2)
+    {
+        Tokens = pass("Optimizer", Par_Optimizer, Tokens);
+        Tokens = pass("Const_Prop", Const_Prop, Tokens);
+        Tokens = pass("Idioms", Idioms, Tokens);
+        Tokens = pass("Dead_Stores", Dead_Stores, Tokens);
+        Tokens = pass("Vectorize", Vectorize, Tokens);
+        Tokens = pass("If_Convert", If_Convert, Tokens);
+    }
+    Report_Program(Tokens);
+
+    return Tokens;
+}
+
+
+// Execute at most fuel tokens of a program
+/*
+    The interpreter loop works on locals, which are loaded from the state on entry
+    and written back on exit, so a program can be paused after any token and resumed later.
+    This lets a caller interleave many programs and enforce a budget on each of them.
 
-    char mem[TAPE_LEN] = {0};
+    Loops that get hot are handed to their trace (see Trace.c) or their machine code (see Jit.c),
+    which run for as long as the fuel lasts and are charged what the tokens would have cost.
 
-    char *ptr = mem; // memory pointer
-    size_t ip = 0;   // instruction pointer
+    Returns
+        RUNNING if the fuel ran out
+        BLOCKED if an IN was reached with no pending input (ip is left on the IN)
+        HALTED  if the program finished
+*/
+Status Step(State_t *s, size_t fuel)
+{
+    List_t *tokens = s->tokens;
+    size_t n = len(tokens);
+
+    char *ptr = s->mem + s->ptr; // memory pointer
+    size_t ip = s->ip;           // instruction pointer
+    Status status = RUNNING;
 
     Tok *tmp;
-    while (ip < len(tokens))
+    Hot *h, *hot = s->hot;
+    struct Memo *memo = s->memo;
+    Profiler *prof = s->prof;
+    size_t left;
+    while (ip < n)
     {
+        if (!fuel--)
+            break;
+
         tmp = tokens->data[ip];
         switch (tmp->flag)
         {
@@ -588,27 +700,124 @@ void nerv(const char *p, Opt o)
                 ptr -= tmp->n;
                 break;
             case LOOP_START:
+                if (prof)
+                    Profile_Enter(prof, ip, ptr - s->mem, *ptr);
                 if (!*ptr)
+                {
                     ip = tmp->offset - 1;
+                    break;
+                }
+
+                // profiled runs stay in the interpreter, the cache, traces and native code run whole loops at once
+                if (prof)
+                    break;
+
+                // skip a pure loop whose result is cached
+                if (memo && Memo_Enter(s, ip, ptr))
+                {
+                    ip = tmp->offset;
+                    break;
+                }
+#if USE_TRACES || USE_JIT
+                h = hot ? &hot[ip] : NULL;
+                if (!h || h->hits < JIT_HOT)
+                {
+                    h = Hot_Loop(s, ip);
+                    hot = s->hot;
+                }
+#endif
+#if USE_JIT
+                if (h->native)
+                {
+                    Regs r = {ptr, fuel};
+                    ip = Run_Native(h->native, &r) - 1;
+                    ptr = r.ptr;
+                    fuel = r.fuel;
+
+                    if (memo && ip == (size_t)tmp->offset)
+                        Memo_Exit(s, ip);
+                    break;
+                }
+#endif
+#if USE_TRACES
+                if (h->trace && (left = Run_Trace(h->trace, ptr, fuel)) != fuel)
+                {
+                    fuel = left;
+
+                    // out of fuel, come back to the loop check
+                    if (*ptr)
+                        goto pause;
+                    ip = tmp->offset;
+
+                    if (memo)
+                        Memo_Exit(s, ip);
+                }
+#endif
                 break;
             case LOOP_END:
                 if (*ptr)
                     ip = tmp->offset - 1;
+                else if (prof)
+                    Profile_Exit(prof, tmp->offset);
+                else if (memo)
+                    Memo_Exit(s, ip);
                 break;
             case IN:
-                *ptr = getchar();
+                if (s->in_pos < s->in_len)
+                    *ptr = s->in[s->in_pos++];
+                else if (s->eof)
+                    *ptr = EOF;
+                else
+                {
+                    status = BLOCKED;
+                    goto pause;
+                }
                 break;
             case OUT:
-#if CAP_OUT
-                fputc(*ptr, output);
-#endif
-                putchar(*ptr);
+                Emit(s, *ptr);
+                break;
+            case PRINT_CONST:
+                Emit_Str(s, tokens->strs + tmp->offset, tmp->n);
                 break;
             case MEM_SET:
                 *ptr = tmp->n;
                 break;
             case MUL:
-                *(ptr + tmp->offset) += *ptr * tmp->n;
+                // the loop a MUL came from may never have been entered
+                // so don't touch the target cell, it can lie off the tape
+                if (*ptr)
+                    *(ptr + tmp->offset) += *ptr * tmp->n;
+                break;
+            case MEM_RANGE:
+                Set_Range(ptr + tmp->offset, tmp->aux, tmp->n);
+                break;
+            case MUL_VEC:
+                // same as MUL, the window may lie off the tape if the loop was never entered
+                if (*ptr)
+                    Mul_Vec(ptr + tmp->offset, (unsigned char *)tokens->strs + tmp->aux, *ptr, tmp->n);
+                break;
+            case COPY:
+                if (*ptr)
+                    *(ptr + tmp->offset) += *ptr;
+                *ptr += *(ptr + tmp->aux);
+                *(ptr + tmp->aux) = 0;
+                break;
+            case CMP:
+                *ptr = *ptr == *(ptr + tmp->offset) ? tmp->n : !tmp->n;
+                *(ptr + tmp->offset) = 0;
+                break;
+            case DIVMOD:
+                Divmod(ptr);
+                break;
+            case IF:
+                if (prof)
+                    Profile_Enter(prof, ip, ptr - s->mem, *ptr);
+                if (!*ptr)
+                    ip = tmp->offset;
+                break;
+            case END_IF:
+                if (prof)
+                    Profile_Exit(prof, tmp->offset);
                 break;
             case COM:
                 break;
@@ -619,10 +828,69 @@ void nerv(const char *p, Opt o)
         ++ip;
     }
 
+    if (ip >= n)
+        status = HALTED;
+
+pause:
+    s->ptr = ptr - s->mem;
+    s->ip = ip;
+
+    return status;
+}
+
+// Run a state to completion, reading its input from stdin
+void Run(State_t *s)
+{
+#if CAP_OUT
+    FILE *output = fopen("./tmp.out", "w");
+
+    if (!output)
+    {
+        fprintf(stderr, "Could not output to tmp.out!\n");
+        exit(EXIT_FAILURE);
+    }
+#endif
+
+    Status status;
+    int c;
+    do
+    {
+        status = Step(s, FUEL);
+
+#if CAP_OUT
+        fwrite(s->out, 1, s->out_len, output);
+#endif
+        Drain(s, stdout);
+
+        // read input one char at a time, as getchar would have
+        if (status == BLOCKED)
+        {
+            fflush(stdout);
+            c = getchar();
+            if (c == EOF)
+                Close_Input(s);
+            else
+            {
+                char ch = c;
+                Feed(s, &ch, 1);
+            }
+        }
+    } while (status != HALTED);
+
 #if CAP_OUT
     fclose(output);
 #endif
+}
+
+// Basic interpreter
+void nerv(const char *p, Opt o)
+{
+    List_t *tokens = Lexer(p, o);
+    State_t *s = State_Cons(tokens);
 
+    Run(s);
+
+    State_Destroy(s);
     Destroy(tokens);
 }
 
@@ -646,19 +914,21 @@ void nervc(const char *p, const char *path, Opt o)
     size_t buffer_len = 0;
 
     // Some basic necessities
-    fprintf(out, "/* Generated by Nerv */\n#include <stdio.h>\n\nint main(void) {\n\tchar mem[%d] = {0};\n\tchar* ptr = mem;\n", TAPE_LEN);
+    fprintf(out, "/* Generated by Nerv */\n#include <stdio.h>\n#include <string.h>\n\nint main(void) {\n\tchar mem[%d] = {0};\n\tchar* ptr = mem;\n", TAPE_LEN);
     for (size_t i = 0; i < len(tokens); ++i)
     {
         Tok *t = tokens->data[i];
 
-        if (buffer_len >= BUFFER_SIZE)
+        // flush before a line that might not fit
+        if (buffer_len + MAX_INDENT + MAX_LINE > BUFFER_SIZE)
         {
             fwrite(buffer, 1, buffer_len, out);
             buffer_len = 0;
         }
 
         // write tabs to buffer
-        for (size_t j = 0; j < indent - (t->flag == LOOP_END); ++j)
+        size_t tabs = indent - (t->flag == LOOP_END || t->flag == END_IF);
+        for (size_t j = 0; j < tabs && j < MAX_INDENT; ++j)
             buffer[buffer_len++] = '\t';
 
         switch (t->flag)
@@ -679,6 +949,7 @@ void nervc(const char *p, const char *path, Opt o)
                 buffer_len += sprintf(&buffer[buffer_len], "*ptr = %d;\n", t->n);
                 break;
             case LOOP_END:
+            case END_IF:
                 indent--;
                 buffer[buffer_len++] = '}';
                 buffer[buffer_len++] = '\n';
@@ -691,11 +962,77 @@ void nervc(const char *p, const char *path, Opt o)
                 break;
             case LOOP_START:
                 indent++;
-                buffer_len += sprintf(&buffer[buffer_len], "while (*ptr) {\n");
+                // a loop the profile never saw run is laid out away from the code around it
+                if (Profile_Cold(t->aux))
+                    buffer_len += sprintf(&buffer[buffer_len], "while (__builtin_expect(*ptr != 0, 0)) {\n");
+                else
+                    buffer_len += sprintf(&buffer[buffer_len], "while (*ptr) {\n");
+                break;
+            case IF:
+                indent++;
+                if (Profile_Cold(t->aux))
+                    buffer_len += sprintf(&buffer[buffer_len], "if (__builtin_expect(*ptr != 0, 0)) {\n");
+                else
+                    buffer_len += sprintf(&buffer[buffer_len], "if (*ptr) {\n");
                 break;
             case MUL:
                 buffer_len += sprintf(&buffer[buffer_len], "*(ptr + %d) += *ptr * %d;\n", t->offset, t->n);
                 break;
+            case PRINT_CONST:
+                // the string can be longer than the buffer, so write it straight out
+                fwrite(buffer, 1, buffer_len, out);
+                buffer_len = 0;
+
+                fputs("fwrite(\"", out);
+                for (int j = 0; j < t->n; ++j)
+                {
+                    unsigned char c = tokens->strs[t->offset + j];
+                    if (c == '"' || c == '\\' || c == '?' || c < ' ' || c > '~')
+                        fprintf(out, "\\%03o", c);
+                    else
+                        fputc(c, out);
+                }
+                fprintf(out, "\", 1, %d, stdout);\n", t->n);
+                break;
+            case MEM_RANGE:
+                buffer_len += sprintf(&buffer[buffer_len], "memset(ptr + %d, %d, %d);\n", t->offset, t->aux, t->n);
+                break;
+            case MUL_VEC:
+                // the coefficients go in a table the C compiler can vectorize the loop over
+                fwrite(buffer, 1, buffer_len, out);
+                buffer_len = 0;
+
+                fputs("if (*ptr) {\n", out);
+                for (size_t j = 0; j < indent + 1; ++j)
+                    fputc('\t', out);
+                fputs("static const unsigned char c[] = {", out);
+                for (int j = 0; j < t->n; ++j)
+                    fprintf(out, j ? ", %d" : "%d", (unsigned char)tokens->strs[t->aux + j]);
+                fputs("};\n", out);
+                for (size_t j = 0; j < indent + 1; ++j)
+                    fputc('\t', out);
+                fprintf(out, "for (int k = 0; k < %d; ++k) ptr[%d + k] += *ptr * c[k];\n", t->n, t->offset);
+                for (size_t j = 0; j < indent; ++j)
+                    fputc('\t', out);
+                fputs("}\n", out);
+                break;
+            case COPY:
+                buffer_len += sprintf(&buffer[buffer_len], "if (*ptr) *(ptr + %d) += *ptr; *ptr += *(ptr + %d); *(ptr + %d) = 0;\n",
+                                      t->offset, t->aux, t->aux);
+                break;
+            case CMP:
+                buffer_len += sprintf(&buffer[buffer_len], "*ptr = *ptr == *(ptr + %d) ? %d : %d; *(ptr + %d) = 0;\n",
+                                      t->offset, t->n, !t->n, t->offset);
+                break;
+            case DIVMOD:
+                // the same checks as Divmod in Kernel.c, the loop after it is the fallback
+                fwrite(buffer, 1, buffer_len, out);
+                buffer_len = 0;
+
+                fputs("if (*ptr && ptr[2] != 1 && !ptr[3] && !ptr[5] && !ptr[6]) { "
+                      "unsigned char n = ptr[0]; unsigned d = (unsigned char)ptr[2] ? (unsigned char)ptr[2] : 256; "
+                      "ptr[0] = 0; ptr[1] += n; ptr[2] = d - n % d; ptr[3] = n % d; ptr[4] += n / d; }\n", out);
+                break;
             case COM:
                 break;
         }
@@ -2,26 +2,53 @@
 #define __NERV_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "List.h"
 #include "Opt.h"
+#include "State.h"
 
 // Read BF File to buffer
 bool Read_BF(const char *, char *, size_t);
 // Compute whether or not a program has valid parens
-bool validate_loop(const char *);
+bool validate_loops(const char *);
+// Hash a buffer
+uint64_t Hash(const void *, size_t);
+// Hash a compiled program
+uint64_t Program_Hash(List_t *);
 // pre-process
 void pproc(char *);
 // Compute loop jumps and store in the IR
 void Comp_Loops(List_t *);
 // Loop unrolling/ Dead Code Removal
 List_t *Optimizer(List_t *);
+// Whether a loop returns the memory pointer to where it started
+bool balanced(List_t *, size_t);
+// Constant propagation, known cell values are folded into the program
+List_t *Const_Prop(List_t *);
+// Known idioms are replaced by COPY, CMP and DIVMOD tokens
+List_t *Idioms(List_t *);
+// Dead store elimination, stores that are never read are removed
+List_t *Dead_Stores(List_t *);
+// Runs of MEM_SET and MUL are merged into MEM_RANGE and MUL_VEC
+List_t *Vectorize(List_t *);
+// Loops that run at most once become IFs
+List_t *If_Convert(List_t *);
+// Tokenize the characters in [lo, hi) of a program onto the end of a list, loop offsets are left unset
+// Every LOOP_START gets its number in the range in aux, counting from 1
+void Lex_Range(const char *, size_t, size_t, Opt, List_t *);
 // Tokenizer/ Lexer
 List_t *Lexer(const char *, Opt);
 // Print list of tokens for debug
 void print_tokens(List_t*, size_t, size_t);
+// Run a state for at most n tokens
+Status Step(State_t *, size_t);
+// Run a state to completion with input from stdin
+void Run(State_t *);
 // interpreter
 void nerv(const char *, Opt);
 // Brainfuck to C compiler
 void nervc(const char *, const char *, Opt);
+// Serve programs over a unix domain socket
+void nerv_serve(const char *);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "nerv.h"
+#include "Gen.h"
+
+/*
+    Scaling benchmark
+
+    Generates programs (see Gen.c) while sweeping one knob at a time from the defaults, and
+    times each stage on them:
+
+        lex      Lex_Range at O1, one thread
+        loops    Comp_Loops on what it made
+        O2       the whole Lexer at O2, threads and all
+        run O0   the program at O0 on its input, which also gives the expected output
+        run O2   the program at O2, checked against the O0 output
+
+    Times are in milliseconds.
+
+    usage: scale [len | depth | mix | span]...    every sweep if none are given
+*/
+
+#define FUEL (1 << 20)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Run a program on an input, returns the time taken and keeps its output
+static double run(List_t *tokens, const char *in, size_t in_len, char **out, size_t *n)
+{
+    State_t *s = State_Cons(tokens);
+    double t = now();
+
+    Feed(s, in, in_len);
+    Close_Input(s);
+    while (Step(s, FUEL) != HALTED)
+        ;
+    t = now() - t;
+
+    *out = malloc(s->out_len + 1);
+    if (!*out)
+    {
+        fprintf(stderr, "Could not allocate memory for the output\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(*out, s->out, s->out_len);
+    *n = s->out_len;
+
+    State_Destroy(s);
+    return t;
+}
+
+static void header(const char *knob)
+{
+    printf("\n%-12s%10s%10s%10s%10s%10s%10s%10s\n", knob, "chars", "tokens", "lex", "loops", "O2", "run O0", "run O2");
+}
+
+// Time every stage on one program and print a row
+static void row(const char *label, const Gen *g)
+{
+    char *in;
+    size_t in_len;
+    char *p = Generate(g, &in, &in_len);
+    size_t ln = strlen(p);
+
+    double t = now();
+    List_t *tokens = Cons(64);
+    Lex_Range(p, 0, ln, O1, tokens);
+    double lex = now() - t;
+
+    t = now();
+    Comp_Loops(tokens);
+    double loops = now() - t;
+    size_t n_tokens = len(tokens);
+    Destroy(tokens);
+
+    t = now();
+    List_t *o2 = Lexer(p, O2);
+    double opt = now() - t;
+
+    List_t *o0 = Lexer(p, O0);
+    char *expected, *out;
+    size_t n_expected, n_out;
+    double run0 = run(o0, in, in_len, &expected, &n_expected);
+    double run2 = run(o2, in, in_len, &out, &n_out);
+
+    bool ok = n_out == n_expected && !memcmp(out, expected, n_out);
+    printf("%-12s%10zu%10zu%10.2f%10.2f%10.2f%10.2f%10.2f%s\n", label, ln, n_tokens, lex, loops, opt, run0, run2,
+           ok ? "" : "  Inccorect Output!");
+
+    free(expected);
+    free(out);
+    Destroy(o0);
+    Destroy(o2);
+    free(p);
+    free(in);
+}
+
+static void sweep_len(void)
+{
+    header("len");
+    for (size_t n = 10000; n <= 1280000; n *= 2)
+    {
+        Gen g = GEN_DEFAULTS;
+        char label[32];
+
+        g.len = n;
+        snprintf(label, sizeof(label), "%zu", n);
+        row(label, &g);
+    }
+}
+
+static void sweep_depth(void)
+{
+    header("depth");
+    for (int d = 0; d <= 8; ++d)
+    {
+        Gen g = GEN_DEFAULTS;
+        char label[32];
+
+        g.depth = d;
+        snprintf(label, sizeof(label), "%d", d);
+        row(label, &g);
+    }
+}
+
+static void sweep_mix(void)
+{
+    const char *names[] = {"mul", "scan", "clear", "io"};
+
+    header("mix");
+    for (int k = 0; k < 4; ++k)
+    {
+        // one kind of block at 4 times its weight, the others off
+        Gen g = GEN_DEFAULTS;
+        g.mul = g.scan = g.clear = g.io = 0;
+        int *w[] = {&g.mul, &g.scan, &g.clear, &g.io};
+        *w[k] = 40;
+
+        row(names[k], &g);
+    }
+}
+
+static void sweep_span(void)
+{
+    header("span");
+    for (size_t n = 16; n <= 16384; n *= 4)
+    {
+        Gen g = GEN_DEFAULTS;
+        char label[32];
+
+        g.span = n;
+        snprintf(label, sizeof(label), "%zu", n);
+        row(label, &g);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct
+    {
+        const char *name;
+        void (*fn)(void);
+    } sweeps[] = {{"len", sweep_len}, {"depth", sweep_depth}, {"mix", sweep_mix}, {"span", sweep_span}};
+
+    for (size_t k = 0; k < sizeof(sweeps) / sizeof(sweeps[0]); ++k)
+    {
+        bool wanted = argc < 2;
+        for (int i = 1; i < argc; ++i)
+            wanted |= !strcmp(argv[i], sweeps[k].name);
+
+        if (wanted)
+            sweeps[k].fn();
+    }
+}
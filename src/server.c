@@ -0,0 +1,749 @@
+#define _GNU_SOURCE // accept4
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "nerv.h"
+
+/*
+    Nerv program server
+
+        nerv --serve <socket path>
+
+    Keeps compiled programs in an LRU cache keyed by the hash of their source,
+    so repeated runs skip reading, lexing and optimizing. The hash is not collision
+    resistant, so a RUN only reuses a cached program if its source is the same byte for
+    byte. A program that hashes like a different cached one is compiled and run on its
+    own, and stays out of the cache, so a HASH always names the first of them.
+    Every connection carries a single run request:
+
+        RUN <opt> <program length> <input length>\n<program><input>
+        HASH <hash> <opt> <input length>\n<input>
+
+    where opt is 0, 1 or 2 and hash is the 16 hex digit hash returned by a previous RUN.
+    The server replies with OK <hash>\n followed by the program's output, and closes
+    the connection once the program halts. Errors are reported as ERR <reason>\n.
+
+    Runs are interleaved with the Step API, each getting SLICE tokens per turn,
+    so a long or non-terminating program cannot starve the other clients.
+    A program that isn't cached is compiled on a thread of its own, which wakes the
+    loop when it is done, so a big program doesn't hold up the runs either.
+
+    When a program is first compiled it is also run up to its first IN, and the
+    snapshot taken there is cached with it. Runs start from the snapshot, so the
+    input independent setup of a program is paid for once rather than on every run.
+    The setup gets a SLICE per turn like any run, and runs of the program wait for it.
+
+    Step doesn't check the pointer against the ends of the tape, the tape has guards
+    instead (see State.h). A run that moves into them faults, and the fault handler jumps
+    back to the scheduler, which fails that run with ERR off the tape\n after whatever
+    output it had made. A fault anywhere else is a bug and still takes the server down.
+*/
+
+#define CACHE_CAP 64          // number of compiled programs to keep around
+#define MAX_EVENTS 64         // events handled per call to epoll_wait
+#define SLICE 65536           // fuel given to a run per turn
+#define SETUP_FUEL (1 << 22)  // most tokens run to reach a program's first IN before giving up on a snapshot
+#define HEAD_MAX 128          // longest request line accepted
+#define BODY_MAX (1 << 26)    // largest program + input accepted
+#define OUT_MAX (1 << 16)     // pause a run while this much of its output is unsent
+#define READ_SIZE 4096
+
+// A compiled program in the cache
+typedef struct Entry
+{
+    uint64_t hash;
+    Opt opt;
+    char *src;              // the source, a RUN reuses the program only if it sent the same
+    size_t src_len;
+    List_t *tokens;
+    Snap_t *snap;           // the program paused at its first IN, or NULL
+    State_t *setup;         // the program on its way there, NULL once it is done
+    size_t setup_fuel;      // fuel the setup has left before it is given up on
+    size_t refs;            // number of runs using the program, only unused entries are evicted
+    unsigned long used;     // tick of the last lookup
+} Entry;
+
+// Where a connection is in its request
+typedef enum Phase
+{
+    HEAD,    // reading the request line
+    BODY,    // reading the program and input
+    COMPILE, // waiting for the program to be compiled
+    SETUP,   // waiting for the setup of the program
+    RUN,     // executing
+    DONE,    // sending the last of the output
+} Phase;
+
+typedef struct Conn
+{
+    int fd;
+    Phase phase;
+
+    char head[HEAD_MAX];
+    size_t head_len;
+
+    char *body;
+    size_t body_len, body_need, prog_len; // prog_len is 0 for HASH requests
+
+    uint64_t hash;
+    Opt opt;
+    Entry *entry;     // cached program, NULL if the run owns its tokens
+    struct Job *job;  // compiling the program, NULL once it is done
+    List_t *tokens;
+    State_t *s;
+
+    char *wbuf;       // output waiting to be sent
+    size_t wlen, wpos, wcap;
+
+    struct Conn *prev, *next;
+} Conn;
+
+// A program compiling on a thread of its own
+typedef struct Job
+{
+    char *program;
+    size_t len;
+    uint64_t hash;
+    Opt opt;
+    List_t *tokens;   // the result
+    atomic_bool done;
+    bool threaded;    // whether thread has to be joined
+    pthread_t thread;
+    Conn *conn;       // the run waiting for it, NULL if the client went away
+    struct Job *next;
+} Job;
+
+static Entry cache[CACHE_CAP];
+static size_t cache_len = 0;
+static unsigned long tick = 0;
+
+static Conn *conns = NULL;
+static Job *jobs = NULL;
+static int ep;
+static int wake;  // eventfd a job writes to when it is done, so epoll_wait returns
+
+// where a run that faults in the guards of its tape comes back to
+static sigjmp_buf off_tape;
+static State_t *running = NULL;
+
+static void on_fault(int sig, siginfo_t *info, void *ctx)
+{
+    (void)ctx;
+
+    if (running && Off_Tape(running, info->si_addr))
+        siglongjmp(off_tape, 1);
+
+    // not a run going off its tape, crash on returning to the faulting instruction
+    signal(sig, SIG_DFL);
+}
+
+// Step a state, returns false if it ran off its tape, after which it can't be stepped again
+static bool slice(State_t *s, size_t fuel, Status *status)
+{
+    if (sigsetjmp(off_tape, 1))
+    {
+        running = NULL;
+        return false;
+    }
+
+    running = s;
+    *status = Step(s, fuel);
+    running = NULL;
+
+    return true;
+}
+
+// Find a program in the cache, and hold on to it
+static Entry *lookup(uint64_t hash, Opt opt)
+{
+    for (size_t i = 0; i < cache_len; ++i)
+    {
+        if (cache[i].hash == hash && cache[i].opt == opt)
+        {
+            cache[i].used = ++tick;
+            cache[i].refs++;
+            return &cache[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Find the cached program of a source, and hold on to it
+// clash is set if a different program with the same hash is cached instead
+static Entry *find(uint64_t hash, Opt opt, const char *src, size_t len, bool *clash)
+{
+    Entry *e = lookup(hash, opt);
+
+    *clash = e && (e->src_len != len || memcmp(e->src, src, len));
+    if (*clash)
+    {
+        e->refs--;
+        return NULL;
+    }
+
+    return e;
+}
+
+// Give the setup of a program a slice of fuel towards its first IN, and snapshot it there
+// Returns whether it needs more, it is given up on if it runs off its tape or takes too long
+static bool set_up(Entry *e)
+{
+    size_t fuel = e->setup_fuel < SLICE ? e->setup_fuel : SLICE;
+    Status status;
+    bool ok = slice(e->setup, fuel, &status);
+
+    e->setup_fuel -= fuel;
+    if (ok && status == RUNNING && e->setup_fuel)
+        return true;
+
+    if (ok && status != RUNNING)
+        e->snap = Checkpoint(e->setup);
+    State_Destroy(e->setup);
+    e->setup = NULL;
+
+    return false;
+}
+
+// Add a program to the cache, evicting the least recently used program that is not running
+// Returns NULL if every entry is in use, in which case the caller keeps ownership of the source and tokens
+static Entry *insert(uint64_t hash, Opt opt, char *src, size_t src_len, List_t *tokens)
+{
+    Entry *e = NULL;
+
+    if (cache_len < CACHE_CAP)
+        e = &cache[cache_len++];
+    else
+    {
+        for (size_t i = 0; i < CACHE_CAP; ++i)
+            if (!cache[i].refs && (!e || cache[i].used < e->used))
+                e = &cache[i];
+
+        if (!e)
+            return NULL;
+
+        if (e->setup)
+            State_Destroy(e->setup);
+        free(e->src);
+        Destroy(e->tokens);
+        if (e->snap)
+            Snap_Destroy(e->snap);
+    }
+
+    e->hash = hash;
+    e->opt = opt;
+    e->src = src;
+    e->src_len = src_len;
+    e->tokens = tokens;
+    e->snap = NULL;
+    e->setup = State_Cons(tokens);
+    e->setup_fuel = SETUP_FUEL;
+    e->refs = 1;
+    e->used = ++tick;
+
+    return e;
+}
+
+// Update the events epoll reports for a connection
+static void watch(Conn *c)
+{
+    struct epoll_event ev;
+    ev.events = 0;
+    ev.data.ptr = c;
+
+    if (c->phase < COMPILE)
+        ev.events |= EPOLLIN;
+    if (c->wpos < c->wlen)
+        ev.events |= EPOLLOUT;
+
+    epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+// Queue bytes to send to a connection
+static void queue(Conn *c, const char *buf, size_t n)
+{
+    if (c->wlen + n > c->wcap)
+    {
+        while (c->wlen + n > c->wcap)
+            c->wcap *= 2;
+        c->wbuf = realloc(c->wbuf, c->wcap);
+
+        if (!c->wbuf)
+        {
+            fprintf(stderr, "Could not reallocate memory for the output of capacity: %zu\n", c->wcap);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memcpy(c->wbuf + c->wlen, buf, n);
+    c->wlen += n;
+}
+
+// Send as much queued output as the socket takes
+// Returns false if the client went away
+static bool flush(Conn *c)
+{
+    while (c->wpos < c->wlen)
+    {
+        ssize_t n = send(c->fd, c->wbuf + c->wpos, c->wlen - c->wpos, MSG_NOSIGNAL);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        c->wpos += n;
+    }
+
+    c->wpos = c->wlen = 0;
+    return true;
+}
+
+static void conn_close(Conn *c)
+{
+    epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+
+    if (c->job)
+        c->job->conn = NULL;
+    if (c->entry)
+        c->entry->refs--;
+    else if (c->tokens)
+        Destroy(c->tokens);
+    if (c->s)
+        State_Destroy(c->s);
+
+    if (c->prev)
+        c->prev->next = c->next;
+    else
+        conns = c->next;
+    if (c->next)
+        c->next->prev = c->prev;
+
+    free(c->body);
+    free(c->wbuf);
+    free(c);
+}
+
+// Report an error to the client and hang up once it is sent
+static void fail(Conn *c, const char *why)
+{
+    char line[HEAD_MAX];
+    int n = snprintf(line, HEAD_MAX, "ERR %s\n", why);
+
+    queue(c, line, n);
+    c->phase = DONE;
+}
+
+// Parse the request line
+static void parse_head(Conn *c)
+{
+    int opt;
+    size_t prog_len, in_len;
+    unsigned long long hash;
+
+    if (sscanf(c->head, "RUN %d %zu %zu", &opt, &prog_len, &in_len) == 3)
+    {
+        if (!prog_len)
+        {
+            fail(c, "empty program");
+            return;
+        }
+    }
+    else if (sscanf(c->head, "HASH %16llx %d %zu", &hash, &opt, &in_len) == 3)
+    {
+        prog_len = 0;
+        c->hash = hash;
+    }
+    else
+    {
+        fail(c, "bad request");
+        return;
+    }
+
+    if (opt < O0 || opt > O2)
+    {
+        fail(c, "bad optimization level");
+        return;
+    }
+    if (prog_len > BODY_MAX || in_len > BODY_MAX - prog_len)
+    {
+        fail(c, "request too large");
+        return;
+    }
+
+    c->opt = opt;
+    c->prog_len = prog_len;
+    c->body_need = prog_len + in_len;
+    c->body = malloc(c->body_need + 1);
+    if (!c->body)
+    {
+        fail(c, "out of memory");
+        return;
+    }
+    c->phase = BODY;
+}
+
+static void *compile(void *arg)
+{
+    Job *j = arg;
+    uint64_t one = 1;
+
+    j->tokens = Lexer(j->program, j->opt);
+    atomic_store(&j->done, true);
+    write(wake, &one, sizeof(one));
+
+    return NULL;
+}
+
+// Find the program or start compiling it, and set up its run
+static void start(Conn *c)
+{
+    if (c->prog_len)
+    {
+        bool clash;
+        c->hash = Hash(c->body, c->prog_len);
+        c->entry = find(c->hash, c->opt, c->body, c->prog_len, &clash);
+
+        if (!c->entry)
+        {
+            Job *j = calloc(1, sizeof(Job));
+            char *program = malloc(c->prog_len + 1);
+            if (!j || !program)
+            {
+                free(j);
+                free(program);
+                fail(c, "out of memory");
+                return;
+            }
+            memcpy(program, c->body, c->prog_len);
+            program[c->prog_len] = '\0';
+
+            if (!validate_loops(program))
+            {
+                free(j);
+                free(program);
+                fail(c, "unbalanced loops");
+                return;
+            }
+
+            j->program = program;
+            j->len = c->prog_len;
+            j->hash = c->hash;
+            j->opt = c->opt;
+            j->conn = c;
+            j->next = jobs;
+            jobs = j;
+            c->job = j;
+
+            // no thread to spare, compile it here
+            j->threaded = !pthread_create(&j->thread, NULL, compile, j);
+            if (!j->threaded)
+            {
+                j->tokens = Lexer(program, c->opt);
+                atomic_store(&j->done, true);
+            }
+        }
+    }
+    else
+    {
+        c->entry = lookup(c->hash, c->opt);
+        if (!c->entry)
+        {
+            fail(c, "unknown hash");
+            return;
+        }
+    }
+
+    if (c->entry)
+        c->tokens = c->entry->tokens;
+
+    char line[HEAD_MAX];
+    int n = snprintf(line, HEAD_MAX, "OK %016llx\n", (unsigned long long)c->hash);
+    queue(c, line, n);
+
+    // the scheduler starts the run once the program is compiled and set up
+    c->phase = c->job ? COMPILE : SETUP;
+}
+
+// Hand a compiled program to the run waiting for it, caching it unless a different program
+// with the same hash is cached, or the same one was compiled for another run meanwhile
+static void compiled(Job *j)
+{
+    Conn *c = j->conn;
+    bool clash;
+    Entry *e = find(j->hash, j->opt, j->program, j->len, &clash);
+
+    if (e)
+        Destroy(j->tokens);
+    else if (!clash && (e = insert(j->hash, j->opt, j->program, j->len, j->tokens)))
+        j->program = NULL;
+    free(j->program);
+
+    if (c)
+    {
+        c->entry = e;
+        c->tokens = e ? e->tokens : j->tokens;
+        c->job = NULL;
+        c->phase = SETUP;
+    }
+    else if (e)
+        e->refs--;
+    else
+        Destroy(j->tokens);
+
+    free(j);
+}
+
+// Start a run, from the program's snapshot if it has one
+static void begin(Conn *c)
+{
+    if (c->entry && c->entry->snap)
+        c->s = Restore(c->entry->snap, c->tokens);
+    else
+        c->s = State_Cons(c->tokens);
+    Feed(c->s, c->body + c->prog_len, c->body_len - c->prog_len);
+    Close_Input(c->s);
+
+    c->phase = RUN;
+}
+
+// Consume bytes of the request
+static void take(Conn *c, const char *buf, size_t n)
+{
+    size_t i = 0;
+
+    while (i < n && c->phase == HEAD)
+    {
+        if (buf[i] == '\n')
+        {
+            c->head[c->head_len] = '\0';
+            parse_head(c);
+        }
+        else if (c->head_len == HEAD_MAX - 1)
+            fail(c, "request line too long");
+        else
+            c->head[c->head_len++] = buf[i];
+        ++i;
+    }
+
+    if (c->phase == BODY)
+    {
+        size_t k = n - i;
+        if (k > c->body_need - c->body_len)
+            k = c->body_need - c->body_len;
+
+        memcpy(c->body + c->body_len, buf + i, k);
+        c->body_len += k;
+
+        if (c->body_len == c->body_need)
+            start(c);
+    }
+}
+
+// Handle readable or hung up connections
+// Returns false if the connection was closed
+static bool on_event(Conn *c, uint32_t events)
+{
+    if (events & (EPOLLHUP | EPOLLERR))
+    {
+        conn_close(c);
+        return false;
+    }
+
+    if (events & EPOLLIN)
+    {
+        char buf[READ_SIZE];
+        ssize_t n = -1;
+
+        while (c->phase < COMPILE && (n = recv(c->fd, buf, READ_SIZE, 0)) > 0)
+            take(c, buf, n);
+
+        // the client stopped sending before the request was complete
+        if (c->phase < COMPILE && (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)))
+        {
+            conn_close(c);
+            return false;
+        }
+    }
+
+    if (!flush(c))
+    {
+        conn_close(c);
+        return false;
+    }
+
+    return true;
+}
+
+static void on_accept(int lfd)
+{
+    int fd;
+    while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+    {
+        Conn *c = calloc(1, sizeof(Conn));
+        if (!c)
+        {
+            close(fd);
+            continue;
+        }
+
+        c->fd = fd;
+        c->phase = HEAD;
+        c->wcap = READ_SIZE;
+        c->wbuf = malloc(c->wcap);
+
+        c->next = conns;
+        if (conns)
+            conns->prev = c;
+        conns = c;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+// Give every runnable connection a slice of fuel
+// Returns whether any run still wants more
+static bool schedule(void)
+{
+    bool busy = false;
+    Conn *next;
+
+    for (Job **at = &jobs; *at;)
+    {
+        Job *j = *at;
+        if (!atomic_load(&j->done))
+        {
+            at = &j->next;
+            continue;
+        }
+
+        if (j->threaded)
+            pthread_join(j->thread, NULL);
+        *at = j->next;
+        compiled(j);
+    }
+
+    for (size_t i = 0; i < cache_len; ++i)
+        if (cache[i].setup)
+            busy = set_up(&cache[i]) || busy;
+
+    for (Conn *c = conns; c; c = next)
+    {
+        next = c->next;
+
+        if (c->phase == SETUP && (!c->entry || !c->entry->setup))
+            begin(c);
+
+        if (c->phase == RUN && c->wlen - c->wpos < OUT_MAX)
+        {
+            // input is closed, so a run can only pause for fuel or halt
+            Status status;
+            bool ok = slice(c->s, SLICE, &status);
+
+            queue(c, c->s->out, c->s->out_len);
+            c->s->out_len = 0;
+
+            if (!ok)
+                fail(c, "off the tape");
+            else if (status == HALTED)
+                c->phase = DONE;
+            else
+                busy = true;
+        }
+
+        if (!flush(c) || (c->phase == DONE && c->wpos == c->wlen))
+        {
+            conn_close(c);
+            continue;
+        }
+
+        watch(c);
+    }
+
+    return busy;
+}
+
+// Serve programs over a unix domain socket
+void nerv_serve(const char *path)
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = on_fault;
+    sa.sa_flags = SA_SIGINFO;
+    sigaction(SIGSEGV, &sa, NULL);
+
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (lfd < 0)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Socket path %s is too long!\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(lfd, SOMAXCONN) < 0)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    ep = epoll_create1(0);
+    wake = eventfd(0, EFD_NONBLOCK);
+    struct epoll_event ev, events[MAX_EVENTS];
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // the listening socket
+    epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &ev);
+    ev.data.ptr = &wake;
+    epoll_ctl(ep, EPOLL_CTL_ADD, wake, &ev);
+
+    fprintf(stderr, "nerv: serving on %s\n", path);
+
+    bool busy = false;
+    for (;;)
+    {
+        // don't block while there are programs to run
+        int n = epoll_wait(ep, events, MAX_EVENTS, busy ? 0 : -1);
+        if (n < 0 && errno != EINTR)
+        {
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            uint64_t done;
+
+            if (!events[i].data.ptr)
+                on_accept(lfd);
+            else if (events[i].data.ptr == &wake)
+                read(wake, &done, sizeof(done));
+            else
+                on_event(events[i].data.ptr, events[i].events);
+        }
+
+        busy = schedule();
+    }
+}
@@ -2,7 +2,20 @@
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include "nerv.h"
+#include "Kernel.h"
+#include "Par.h"
+#include "Gen.h"
+#include "Profile.h"
+#include "Trace.h"
+#include "Memo.h"
+#include "Report.h"
 
 #define BENCH_PATH "./examples/benchmarks/"
 #define BUFF_SIZE 90000
@@ -78,9 +91,1171 @@ int test_interpreter(void)
     return correct;
 }
 
+// Run every benchmark in small slices of fuel and check it resumes correctly
+int test_step(void)
+{
+    int correct = 0;
+
+    char buff[BUFF_SIZE], exp[OUT_SIZE];
+
+    for (int i = 0; i < BN; ++i)
+    {
+        if (!Read_BF(benchmarks[i], buff, BUFF_SIZE) || !Read_BF(bench_outs[i], exp, OUT_SIZE))
+        {
+            fprintf(stderr, "Could not read: %s\n", benchmarks[i]);
+            exit(EXIT_FAILURE);
+        }
+
+        List_t *tokens = Lexer(buff, O2);
+        State_t *s = State_Cons(tokens);
+        size_t slices = 0;
+
+        Close_Input(s);
+        while (Step(s, 1000) != HALTED)
+            slices++;
+        Emit(s, '\0');
+        pproc(s->out); // Read_BF pre-processes the expected output too
+
+        printf("%s\t%zu slices\t", benchmarks[i], slices);
+        if (!strcmp(s->out, exp))
+        {
+            correct++;
+            printf("Correct Output!\n");
+        }
+        else
+            printf("Inccorect Output!\n");
+
+        State_Destroy(s);
+        Destroy(tokens);
+    }
+
+    return correct;
+}
+
+// Connect to the server, send a request and read the whole reply, or as much as fits
+// a client that stops reading leaves its socket open, returned through keep
+#define SERVE_PATH "./tmp.sock"
+#define REPLY_SIZE 4096
+#define SERVE_CACHE 64  // CACHE_CAP of the server
+static size_t ask(const char *req, size_t n, char *reply, int *keep)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, SERVE_PATH);
+
+    // the server may still be starting up
+    int fd = -1;
+    for (int tries = 0; tries < 100; ++tries)
+    {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (!connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+            break;
+        close(fd);
+        fd = -1;
+        usleep(20000);
+    }
+    if (fd < 0)
+        return 0;
+
+    // don't hang the tests on a server that stopped answering
+    struct timeval tv = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    write(fd, req, n);
+    shutdown(fd, SHUT_WR);
+    if (keep)
+    {
+        *keep = fd;
+        return 0;
+    }
+
+    size_t got = 0;
+    ssize_t k;
+    while (got < REPLY_SIZE - 1 && (k = read(fd, reply + got, REPLY_SIZE - 1 - got)) > 0)
+        got += k;
+    reply[got] = '\0';
+    close(fd);
+
+    return got;
+}
+
+// Resident memory of a process in kB
+static long rss(pid_t pid)
+{
+    char path[64], line[256];
+    long kb = -1;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE *fp = fopen(path, "r");
+    while (fp && fgets(line, sizeof(line), fp))
+        if (sscanf(line, "VmRSS: %ld", &kb) == 1)
+            break;
+    if (fp)
+        fclose(fp);
+
+    return kb;
+}
+
+// Run a server in a child and check what it answers
+#define SN 7
+int test_server(void)
+{
+    int correct = 0;
+    char reply[REPLY_SIZE], req[256];
+    bool ok;
+
+    unlink(SERVE_PATH);
+    pid_t pid = fork();
+    if (!pid)
+    {
+        // keep the server's own messages out of the test output
+        freopen("/dev/null", "w", stderr);
+        nerv_serve(SERVE_PATH);
+        exit(EXIT_SUCCESS);
+    }
+
+    // a run off either end of the tape fails, and the server is still there for the next one
+    ask("RUN 2 5 0\n+[<+]", 15, reply, NULL);
+    ok = !strncmp(reply, "OK ", 3) && strstr(reply, "ERR off the tape");
+    ask("RUN 0 5 0\n+[>+]", 15, reply, NULL);
+    ok = ok && strstr(reply, "ERR off the tape");
+    printf("off the tape\t%s\n", ok ? "Correct Output!" : "Inccorect Output!");
+    correct += ok;
+
+    // a program that prints before it reads starts from the snapshot at its first IN, twice
+    const char *echo = "++++++++[>++++++++<-]>+.,.";
+    int n = snprintf(req, sizeof(req), "RUN 0 %zu 1\n%sZ", strlen(echo), echo);
+    ask(req, n, reply, NULL);
+    ok = !strcmp(reply + 20, "AZ");
+    n = snprintf(req, sizeof(req), "RUN 0 %zu 1\n%sY", strlen(echo), echo);
+    ask(req, n, reply, NULL);
+    ok = ok && !strcmp(reply + 20, "AY");
+    printf("setup\t\t%s\n", ok ? "Correct Output!" : "Inccorect Output!");
+    correct += ok;
+
+    const char *hello = "++++++++[>++++[>++>+++>+++>+<<<<-]>+>+>->>+[<]<-]>>.>---.+++++++..+++.>>.<-.<.+++.------.--------.>>+.>++.";
+    n = snprintf(req, sizeof(req), "RUN 2 %zu 0\n%s", strlen(hello), hello);
+    ask(req, n, reply, NULL);
+    ok = !strncmp(reply, "OK ", 3) && !strcmp(reply + 20, "Hello World!\n");
+    printf("run\t\t%s\n", ok ? "Correct Output!" : "Inccorect Output!");
+    correct += ok;
+
+    // the same program again by its hash, from the cache
+    char hash[17] = {0};
+    memcpy(hash, reply + 3, 16);
+    n = snprintf(req, sizeof(req), "HASH %s 2 0\n", hash);
+    ask(req, n, reply, NULL);
+    ok = !strncmp(reply, "OK ", 3) && !strcmp(reply + 20, "Hello World!\n");
+    printf("hash\t\t%s\n", ok ? "Correct Output!" : "Inccorect Output!");
+    correct += ok;
+
+    // a client that doesn't read holds its run, not the server or its own output in memory
+    int stalled;
+    ask("RUN 2 4 0\n+[.]", 14, reply, &stalled);
+    usleep(100000);
+    long before = rss(pid);
+    n = snprintf(req, sizeof(req), "RUN 1 %zu 0\n%s", strlen(hello), hello);
+    ask(req, n, reply, NULL);
+    ok = !strcmp(reply + 20, "Hello World!\n");
+    usleep(500000);
+    ok = ok && rss(pid) - before < 16 * 1024 && read(stalled, reply, REPLY_SIZE) > 0 && !strncmp(reply, "OK ", 3);
+    close(stalled);
+    printf("back-pressure\t%s\n", ok ? "Correct Output!" : "Inccorect Output!");
+    correct += ok;
+
+    // a big program compiles on a thread of its own, a small one sent after it runs meanwhile
+    const char *block = ">,[<+>-]<.";
+    size_t blocks = 400000, block_len = strlen(block), big_len = block_len * blocks;
+    char *big = malloc(big_len + 64);
+    int head = sprintf(big, "RUN 2 %zu 0\n", big_len);
+    for (size_t i = 0; i < blocks; ++i)
+        memcpy(big + head + i * block_len, block, block_len);
+    int slow;
+    ask(big, head + big_len, reply, &slow);
+    free(big);
+
+    n = snprintf(req, sizeof(req), "RUN 2 %zu 0\n%s", strlen(hello), hello);
+    ask(req, n, reply, NULL);
+    ok = !strcmp(reply + 20, "Hello World!\n");
+
+    // by then the big one has at most its OK line, and it prints a byte a block once it runs
+    ssize_t k = recv(slow, reply, REPLY_SIZE, MSG_DONTWAIT);
+    ok = ok && k <= 20;
+    size_t got = k > 0 ? k : 0;
+    while ((k = read(slow, reply, REPLY_SIZE)) > 0)
+        got += k;
+    ok = ok && got == 20 + blocks;
+    close(slow);
+    printf("compile\t\t%s\n", ok ? "Correct Output!" : "Inccorect Output!");
+    correct += ok;
+
+    // once more programs than the cache holds have run since, a program is gone, the last one isn't
+    char prog[2 * SERVE_CACHE + 2];
+    memset(prog, '+', sizeof(prog));
+    for (int i = 1; i <= 2 * SERVE_CACHE; ++i)
+    {
+        prog[i] = '.';
+        n = snprintf(req, sizeof(req), "RUN 0 %d 0\n%.*s", i + 1, i + 1, prog);
+        ask(req, n, reply, NULL);
+        prog[i] = '+';
+    }
+    char last[17] = {0};
+    memcpy(last, reply + 3, 16);
+
+    n = snprintf(req, sizeof(req), "HASH %s 2 0\n", hash);
+    ask(req, n, reply, NULL);
+    ok = !strcmp(reply, "ERR unknown hash\n");
+    n = snprintf(req, sizeof(req), "HASH %s 0 0\n", last);
+    ask(req, n, reply, NULL);
+    ok = ok && !strncmp(reply, "OK ", 3) && reply[20] == (char)(2 * SERVE_CACHE);
+    printf("eviction\t%s\n", ok ? "Correct Output!" : "Inccorect Output!");
+    correct += ok;
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    unlink(SERVE_PATH);
+
+    return correct;
+}
+
+// Checkpoint generated programs at their first IN, then finish them from the snapshot read back
+// and check damaged snapshots are turned away
+#define CN 4
+int test_snapshot(void)
+{
+    int correct = 0;
+
+    for (int i = 0; i < CN; ++i)
+    {
+        Gen g = GEN_DEFAULTS;
+        g.seed = i + 1;
+
+        char *in;
+        size_t in_len, n_exp;
+        char *p = Generate(&g, &in, &in_len);
+        char *exp = Expected(p, in, in_len, &n_exp);
+
+        List_t *tokens = Lexer(p, O2);
+        State_t *s = State_Cons(tokens);
+        while (Step(s, 1000) == RUNNING)
+            ;
+
+        Snap_t *snap = Checkpoint(s);
+        State_Destroy(s);
+        bool ok = Save_Snap(snap, "./tmp.snap");
+        Snap_Destroy(snap);
+
+        snap = Load_Snap("./tmp.snap");
+        s = snap ? Restore(snap, tokens) : NULL;
+        ok = ok && s;
+        if (s)
+        {
+            Feed(s, in, in_len);
+            Close_Input(s);
+            while (Step(s, 1000) != HALTED)
+                ;
+            ok = s->out_len == n_exp && !memcmp(s->out, exp, n_exp);
+            State_Destroy(s);
+        }
+
+        // an ip past the end of the program
+        if (snap)
+        {
+            snap->ip = len(tokens) + 1;
+            ok = ok && !Restore(snap, tokens);
+            Snap_Destroy(snap);
+        }
+
+        // a pointer off the tape, output longer than the file, and a file cut short
+        // the head is the magic then prog, ptr, ip, tape_len, tape_off and out_len, 8 bytes each
+        uint64_t bad = TAPE_LEN;
+        int fd = open("./tmp.snap", O_RDWR);
+        ok = ok && pwrite(fd, &bad, 8, 16) == 8 && !Load_Snap("./tmp.snap");
+        bad = 0;
+        ok = ok && pwrite(fd, &bad, 8, 16) == 8 && (snap = Load_Snap("./tmp.snap"));
+        if (snap)
+            Snap_Destroy(snap);
+        bad = 1 << 20;
+        ok = ok && pwrite(fd, &bad, 8, 48) == 8 && !Load_Snap("./tmp.snap");
+        ok = ok && !ftruncate(fd, 4096) && !Load_Snap("./tmp.snap");
+        close(fd);
+
+        printf("seed %d\t%zu bytes out\t%s\n", i + 1, n_exp, ok ? "Correct Output!" : "Inccorect Output!");
+        correct += ok;
+
+        Destroy(tokens);
+        free(p);
+        free(in);
+        free(exp);
+    }
+
+    remove("./tmp.snap");
+    return correct;
+}
+
+// Run a program to the end at a level on an input, the output is malloc'd and its length stored
+static char *run_at(const char *p, Opt o, const char *in, size_t in_len, size_t *n)
+{
+    List_t *tokens = Lexer(p, o);
+    State_t *s = State_Cons(tokens);
+
+    Feed(s, in, in_len);
+    Close_Input(s);
+    while (Step(s, 1 << 20) != HALTED)
+        ;
+
+    char *out = malloc(s->out_len + 1);
+    if (!out)
+    {
+        fprintf(stderr, "Could not allocate memory for the output\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(out, s->out, s->out_len);
+    *n = s->out_len;
+
+    State_Destroy(s);
+    Destroy(tokens);
+    return out;
+}
+
+// A small program aimed at one path of an optimization, with the input it needs to halt
+// and how many tokens of a type it has at O2: none if count is -1, not checked if it is 0
+typedef struct Case
+{
+    const char *name, *p, *in;
+    size_t in_len;
+    int count;
+    Type flag;
+} Case;
+
+// Number of tokens of a type in a program lexed at a level
+static int count_flag(const char *p, Opt o, Type flag)
+{
+    List_t *tokens = Lexer(p, o);
+    int count = 0;
+
+    for (size_t i = 0; i < len(tokens); ++i)
+        count += tokens->data[i]->flag == flag;
+
+    Destroy(tokens);
+    return count;
+}
+
+// Check the cases print the same at O1 and O2 as at O0, and that O2 did what they aim at
+static int check_cases(const Case *cases, int n)
+{
+    int correct = 0;
+
+    for (int i = 0; i < n; ++i)
+    {
+        const Case *c = &cases[i];
+        size_t n_exp, n_out;
+        char *exp = run_at(c->p, O0, c->in, c->in_len, &n_exp);
+        bool ok = true;
+
+        for (Opt o = O1; o <= O2; ++o)
+        {
+            char *out = run_at(c->p, o, c->in, c->in_len, &n_out);
+            ok = ok && n_out == n_exp && !memcmp(out, exp, n_exp);
+            free(out);
+        }
+
+        if (c->count)
+            ok = ok && count_flag(c->p, O2, c->flag) == (c->count < 0 ? 0 : c->count);
+
+        printf("%-24s%s\n", c->name, ok ? "Correct Output!" : "Inccorect Output!");
+        correct += ok;
+        free(exp);
+    }
+
+    return correct;
+}
+
+// Programs that walk Const_Prop through unrolling, rolling an unroll back, and running out of fuel
+#define PROP_CASES 7
+const Case prop_cases[PROP_CASES - 2] = {
+    {"unroll", "+++[>.+<-]", "", 0, -1, LOOP_START},
+    {"unroll nested", "++[>+++[>.+<-]<-]", "", 0, -1, LOOP_START},
+    {"unknown trip count", "++[>+<,]>.", "\1\0", 2, 1, LOOP_START},
+    {"rolled back inside", "++[>+[>.<,]<-]", "\5\0\0", 3, 2, LOOP_START},
+    {"too big to unroll", ",>-[>.+<<.>-]", "a", 1, 1, LOOP_START},
+};
+
+// A program whose loops each burn some fuel on an unroll that gets rolled back, n times over,
+// followed by a tail
+static char *burn(int n, const char *tail)
+{
+    const char *block = ">,>-[<.>>.<-]";
+    char *p = malloc(strlen(block) * n + strlen(tail) + 1), *at = p;
+
+    for (int i = 0; i < n; ++i)
+        at = stpcpy(at, block);
+    strcpy(at, tail);
+
+    return p;
+}
+
+int test_const_prop(void)
+{
+    int correct = check_cases(prop_cases, PROP_CASES - 2);
+
+    // the tail unrolls into a PRINT_CONST with a few blocks in front of it, and is kept once they use up PROP_FUEL
+    const int blocks[2] = {4, 4000};
+    char in[4000];
+    memset(in, 'x', sizeof(in));
+
+    for (int k = 0; k < 2; ++k)
+    {
+        char *p = burn(blocks[k], ">>+++[>.+<-]");
+        size_t n_exp, n_out;
+        char *exp = run_at(p, O0, in, blocks[k], &n_exp);
+        char *out = run_at(p, O2, in, blocks[k], &n_out);
+
+        List_t *tokens = Lexer(p, O2);
+        Type last = tokens->data[len(tokens) - 1]->flag;
+        bool ok = n_out == n_exp && !memcmp(out, exp, n_exp) && last == (k ? LOOP_END : PRINT_CONST);
+
+        printf("%-24s%s\n", k ? "out of fuel" : "fuel left", ok ? "Correct Output!" : "Inccorect Output!");
+        correct += ok;
+
+        Destroy(tokens);
+        free(p);
+        free(exp);
+        free(out);
+    }
+
+    return correct;
+}
+
+// A program that prints some bytes, each built up on a fresh cell so they are all known
+static char *print_bytes(const unsigned char *bytes, size_t n)
+{
+    size_t size = 1;
+    for (size_t i = 0; i < n; ++i)
+        size += bytes[i] + 2;
+
+    char *p = malloc(size), *at = p;
+    for (size_t i = 0; i < n; ++i)
+    {
+        *at++ = '>';
+        memset(at, '+', bytes[i]);
+        at += bytes[i];
+        *at++ = '.';
+    }
+    *at = '\0';
+
+    return p;
+}
+
+// Compile a program to C with nervc, build it and run it on some input, the output is malloc'd and its length stored
+static char *run_nervc(const char *p, const char *in, size_t in_len, size_t *n)
+{
+    char *out = malloc(OUT_SIZE * 100);
+    *n = 0;
+
+    FILE *fp = fopen("./tmp.in", "w");
+    fwrite(in, 1, in_len, fp);
+    fclose(fp);
+
+    nervc(p, "./tmp.c", O2);
+    fp = system("cc -w -o ./tmp.bin ./tmp.c") ? NULL : popen("./tmp.bin < ./tmp.in", "r");
+    if (fp)
+    {
+        *n = fread(out, 1, OUT_SIZE * 100, fp);
+        pclose(fp);
+    }
+
+    remove("./tmp.c");
+    remove("./tmp.bin");
+    remove("./tmp.in");
+    return out;
+}
+
+// Output folded into PRINT_CONST has to come out byte for byte, from the interpreter and from nervc
+#define PC_CASES 4
+int test_print_const(void)
+{
+    int correct = 0;
+
+    // what C strings need escaped, trigraphs, a NUL in the middle, and bytes past ASCII
+    const unsigned char bytes[] = {'"', '\\', '?', '?', '=', 0, '\n', 'a', 200, 255, 128, '\t', '"'};
+    char *p = print_bytes(bytes, sizeof(bytes));
+    size_t n_exp, n_out;
+    char *exp = run_at(p, O0, "", 0, &n_exp);
+
+    // all of it in one PRINT_CONST, with no OUT left
+    List_t *tokens = Lexer(p, O2);
+    int prints = 0, outs = 0;
+    for (size_t i = 0; i < len(tokens); ++i)
+    {
+        prints += tokens->data[i]->flag == PRINT_CONST;
+        outs += tokens->data[i]->flag == OUT;
+    }
+    bool ok = prints == 1 && !outs;
+    Destroy(tokens);
+
+    char *out = run_at(p, O2, "", 0, &n_out);
+    ok = ok && n_exp == sizeof(bytes) && n_out == n_exp && !memcmp(out, exp, n_exp);
+    printf("%-24s%s\n", "escapes", ok ? "Correct Output!" : "Inccorect Output!");
+    correct += ok;
+    free(out);
+
+    out = run_nervc(p, "", 0, &n_out);
+    ok = n_out == n_exp && !memcmp(out, exp, n_exp);
+    printf("%-24s%s\n", "escapes in C", ok ? "Correct Output!" : "Inccorect Output!");
+    correct += ok;
+    free(out);
+    free(exp);
+    free(p);
+
+    // known output pending on both sides of a loop that is kept once the fuel is gone, and in it
+    const char *tail = ">>+++.>++[<.>-]<.";
+    const int blocks[2] = {4, 4000};
+    char in[4000];
+    memset(in, 'x', sizeof(in));
+
+    for (int k = 0; k < 2; ++k)
+    {
+        p = burn(blocks[k], tail);
+        exp = run_at(p, O0, in, blocks[k], &n_exp);
+        out = run_at(p, O2, in, blocks[k], &n_out);
+
+        ok = n_out == n_exp && !memcmp(out, exp, n_exp);
+        printf("%-24s%s\n", k ? "merged out of fuel" : "merged with fuel", ok ? "Correct Output!" : "Inccorect Output!");
+        correct += ok;
+
+        free(p);
+        free(exp);
+        free(out);
+    }
+
+    return correct;
+}
+
+// Check every kernel the CPU supports against the scalar ones, over windows of every length up to KN
+// the ones it doesn't support aren't tested, and aren't counted in tested either
+#define KN 100
+int test_kernels(int *tested)
+{
+    int correct = 0;
+    *tested = 0;
+
+    unsigned char coef[KN];
+    char init[KN], exp[KN], out[KN];
+
+    srand(1);
+    for (int i = 0; i < KN; ++i)
+    {
+        coef[i] = rand();
+        init[i] = rand();
+    }
+
+    for (Kernel k = KERNEL_SCALAR; k < KERNEL_COUNT; ++k)
+    {
+        if (!Kernel_Select(k))
+        {
+            printf("%s\tNot Supported\n", Kernel_Name(k));
+            continue;
+        }
+
+        bool ok = true;
+
+        for (size_t n = 0; n <= KN && ok; ++n)
+        {
+            Kernel_Select(KERNEL_SCALAR);
+            memcpy(exp, init, KN);
+            Mul_Vec(exp, coef, 201, n);
+            Set_Range(exp + n / 2, 7, n / 2);
+
+            Kernel_Select(k);
+            memcpy(out, init, KN);
+            Mul_Vec(out, coef, 201, n);
+            Set_Range(out + n / 2, 7, n / 2);
+
+            ok = !memcmp(out, exp, KN);
+        }
+
+        printf("%s\t%s\n", Kernel_Name(k), ok ? "Correct Output!" : "Inccorect Output!");
+        correct += ok;
+        (*tested)++;
+    }
+
+    Kernel_Select(Kernel_Best());
+    return correct;
+}
+
+// Runs of clears and MULs right at the thresholds of Vectorize, and a fan out too wide for it
+#define VEC_CASES 5
+const Case vec_cases[VEC_CASES] = {
+    {"RANGE_MIN clears", ">,>,>,>,<<<<,[>[-]>[-]>[-]>[-]<<<<-]>.>.>.>.", "abcd\2", 5, 1, MEM_RANGE},
+    {"one clear short", ">,>,>,<<<,[>[-]>[-]>[-]<<<-]>.>.>.", "abc\2", 4, -1, MEM_RANGE},
+    {"VEC_MIN muls", ",[->+>++>+++<<<]>.>.>.", "\5", 1, 1, MUL_VEC},
+    {"one mul short", ",[->+>++<<]>.>.", "\5", 1, -1, MUL_VEC},
+    {"wider than VEC_SPAN", ",[->+>+>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>+"
+                            "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<]"
+                            ">.>.>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>.", "\5", 1, -1, MUL_VEC},
+};
+
+int test_vectorize(void)
+{
+    return check_cases(vec_cases, VEC_CASES);
+}
+
+// Programs whose first loop runs a few times around one type of token, all but the last two can be traced
+#define TRACE_CASES 7
+#define HOT_CASES 9
+const Case hot_cases[HOT_CASES] = {
+    {"SUM and MEM_SET", ",[>+>[-]+<<-]>.>.", "\24", 1, 1, MEM_SET},
+    {"MUL", ",[>>+++<[->+<]<-]>.>.", "\24", 1, 1, MUL},
+    {"MEM_RANGE", ",[>[-]>[-]>[-]>[-]>+<<<<<-]>.>.>.>.>.", "\24", 1, 1, MEM_RANGE},
+    {"MUL_VEC", ",[>+++[->+>++>+++<<<]<-]>.>.>.>.", "\24", 1, 1, MUL_VEC},
+    {"COPY", ",[>+++[->+>+<<]>>[-<<+>>]<<<-]>.>.>.", "\24", 1, 1, COPY},
+    {"CMP", ",[>+++>++<[->-<]+>[<->[-]]<<-]>.>.", "\24", 1, 1, CMP},
+    {"IF", ",[>>+<[>+<-]>[<+>[-]]<<-]>.>.>.", "\24", 1, 1, IF},
+    {"DIVMOD", ",[>++++++++>>+++<<[->+>-[>+>>]>[+[-<+>]>+>>]<<<<<<]>[-]>[-]>[-]>[-]>[-]<<<<<<-]>.>.>.>.>.>.",
+               "\24", 1, 1, DIVMOD},
+    {"nested", ",[>++[>+++[>+<-]<-]<-]>.>.>.", "\24", 1, 2, LOOP_START},
+};
+
+// Run a case with its first loop forced up to a tier, a few tokens of fuel at a time, against the
+// interpreter: every pause must be a state the interpreter goes through, some of them at a loop, and both must end the same
+#define TIER_FUEL 50
+static bool check_tier(const Case *c, unsigned tier)
+{
+    List_t *tokens = Lexer(c->p, O2);
+    State_t *ref = State_Cons(tokens), *s = State_Cons(tokens);
+    size_t ip = 0;
+    int pauses = 0;
+
+    while (tokens->data[ip]->flag != LOOP_START)
+        ++ip;
+
+    // profiled runs stay in the interpreter
+    Profile_Enable(ref);
+    Hot *h = Hot_Loop(s, ip);
+    h->hits = tier - 1;
+    h = Hot_Loop(s, ip);
+    bool ok = count_flag(c->p, O2, c->flag) == c->count && (tier == JIT_HOT ? h->native != NULL : h->trace != NULL);
+
+    Feed(ref, c->in, c->in_len);
+    Close_Input(ref);
+    Feed(s, c->in, c->in_len);
+    Close_Input(s);
+
+    while (ok && Step(s, TIER_FUEL) != HALTED)
+    {
+        // walk the interpreter up to the same point
+        Status status = RUNNING;
+        while (status != HALTED && (ref->ip != s->ip || ref->ptr != s->ptr || memcmp(ref->mem, s->mem, TAPE_LEN)))
+            status = Step(ref, 1);
+        ok = status != HALTED;
+        pauses += tokens->data[s->ip]->flag == LOOP_START;
+    }
+    while (Step(ref, 1 << 20) != HALTED)
+        ;
+
+    ok = ok && pauses && ref->ip == s->ip && ref->ptr == s->ptr && !memcmp(ref->mem, s->mem, TAPE_LEN)
+         && ref->out_len == s->out_len && !memcmp(ref->out, s->out, s->out_len);
+
+    State_Destroy(ref);
+    State_Destroy(s);
+    Destroy(tokens);
+    return ok;
+}
+
+// Force the loops up to traces, run out of fuel inside them and resume
+int test_traces(void)
+{
+    int correct = 0;
+
+    for (int i = 0; i < TRACE_CASES; ++i)
+    {
+        bool ok = check_tier(&hot_cases[i], TRACE_HOT);
+        printf("%-24s%s\n", hot_cases[i].name, ok ? "Correct Output!" : "Inccorect Output!");
+        correct += ok;
+    }
+
+    return correct;
+}
+
+// Force the loops up to native code, run out of fuel inside them and resume
+int test_jit(void)
+{
+    int correct = 0;
+
+    for (int i = 0; i < HOT_CASES; ++i)
+    {
+        bool ok = check_tier(&hot_cases[i], JIT_HOT);
+        printf("%-24s%s\n", hot_cases[i].name, ok ? "Correct Output!" : "Inccorect Output!");
+        correct += ok;
+    }
+
+    return correct;
+}
+
+// Run a program at O2 with the memo cache on against O0, used tells if the cache must have
+// skipped a loop or must not have looked any up
+static bool check_memo(const char *p, const char *in, size_t in_len, bool used)
+{
+    size_t n_exp;
+    char *exp = run_at(p, O0, in, in_len, &n_exp);
+    List_t *tokens = Lexer(p, O2);
+    State_t *s = State_Cons(tokens);
+
+    Memo_Enable(s);
+    Feed(s, in, in_len);
+    Close_Input(s);
+    while (Step(s, 1 << 20) != HALTED)
+        ;
+
+    char stats[256] = {0};
+    size_t n_hits = 0, n_misses = 0;
+    FILE *fp = fmemopen(stats, sizeof(stats), "w");
+    Memo_Stats(s, fp);
+    fclose(fp);
+    sscanf(stats, "memo: %zu hits, %zu misses", &n_hits, &n_misses);
+
+    bool ok = s->out_len == n_exp && !memcmp(s->out, exp, n_exp) && (used ? n_hits > 0 : !n_hits && !n_misses);
+
+    State_Destroy(s);
+    Destroy(tokens);
+    free(exp);
+    return ok;
+}
+
+// Loops whose cells hang off either end of the tape, which the cache must leave alone,
+// and a loop entered on the same cells over and over, which it must skip
+#define MEMO_CASES 3
+int test_memo(void)
+{
+    int correct = 0;
+    bool ok;
+
+    ok = check_memo(",[->[<<[->>>+<<<]>>[-]]>+<<]>>.", "\5", 1, false);
+    printf("%-24s%s\n", "off the left end", ok ? "Correct Output!" : "Inccorect Output!");
+    correct += ok;
+
+    const char *mirror = ",[-<[>>[-<<<+>>>]<<[-]]<+>>]<<.";
+    char *p = malloc(TAPE_LEN + strlen(mirror));
+    memset(p, '>', TAPE_LEN - 1);
+    strcpy(p + TAPE_LEN - 1, mirror);
+    ok = check_memo(p, "\5", 1, false);
+    printf("%-24s%s\n", "off the right end", ok ? "Correct Output!" : "Inccorect Output!");
+    correct += ok;
+    free(p);
+
+    ok = check_memo(",[>>,[>+>[-]+>+>+<<<<-]>.[-]>.>.[-]>.[-]<<<<<<-]", "\5\3\3\3\3\3", 6, true);
+    printf("%-24s%s\n", "same cells", ok ? "Correct Output!" : "Inccorect Output!");
+    correct += ok;
+
+    return correct;
+}
+
+// Stores on either side of a balanced loop: one the loop doesn't read and that is overwritten after it,
+// one the loop reads, and one that is only overwritten inside a loop that doesn't run
+#define DSE_CASES 3
+const Case dse_cases[DSE_CASES] = {
+    {"dead across a loop", ">,+<,[>>+>[-]+<<<-]>[-]+>.>.<<.", "\7\3", 2, 1, SUM},
+    {"read in the loop", ">+++<,[>.+>[-]+<<-]>>.", "\3", 1, 2, MEM_SET},
+    {"loop that doesn't run", ">+++<,[>[-]>+<<-]>.>.", "\0", 1, 2, MEM_SET},
+};
+
+int test_dead_stores(void)
+{
+    return check_cases(dse_cases, DSE_CASES);
+}
+
+// Each idiom on values read in, and DIVMOD with scratch cells it can't use, where it must leave
+// the work to the loop kept after it, and a program of COPYs and CMPs written out as C
+#define DIVMOD_LOOP "[->+>-[>+>>]>[+[-<+>]>+>>]<<<<<<]"
+#define IDIOM_CASES 10
+#define IDIOM_C_BLOCKS 200
+const Case idiom_cases[IDIOM_CASES - 1] = {
+    {"COPY", ",[->+>+<<]>>[-<<+>>]<.<.", "\7", 1, 1, COPY},
+    {"COPY temp first", ",[->>+<+<]>>[-<<+>>]<.<.", "\7", 1, 1, COPY},
+    {"CMP(1) equal", ",>,<[->-<]+>[<->[-]]<.", "\5\5", 2, 1, CMP},
+    {"CMP(1) not equal", ",>,<[->-<]+>[<->[-]]<.", "\5\3", 2, 1, CMP},
+    {"CMP(0)", ",>,<[->-<]>[<+>[-]]<.", "\5\3", 2, 1, CMP},
+    {"DIVMOD", ",>>,<<" DIVMOD_LOOP ">.>.>.>.", "\21\3", 2, 1, DIVMOD},
+    {"DIVMOD by 256", ",>>,<<" DIVMOD_LOOP ">.>.>.>.", "\21\0", 2, 1, DIVMOD},
+    {"DIVMOD dirty 3", ",>>,>,<<<" DIVMOD_LOOP ">.>.>.>.>.", "\21\3\2", 3, 1, DIVMOD},
+    {"DIVMOD dirty 5 and 6", ",>>,>>>,>,<<<<<<" DIVMOD_LOOP ">.>.>.>.>.>.", "\21\3\2\4", 4, 1, DIVMOD},
+};
+
+int test_idioms(void)
+{
+    int correct = check_cases(idiom_cases, IDIOM_CASES - 1);
+
+    // their lines are the longest nervc writes, enough of them fill its buffer many times over
+    const char *block = ",>,<[->+>+<<]>>[-<<+>>]<[->-<]+>[<->[-]]<.";
+    char *p = malloc(IDIOM_C_BLOCKS * strlen(block) + 1);
+    char in[2 * IDIOM_C_BLOCKS];
+    p[0] = '\0';
+    for (int i = 0; i < IDIOM_C_BLOCKS; ++i)
+    {
+        strcat(p, block);
+        in[2 * i] = i;
+        in[2 * i + 1] = i % 3 ? i : 2 * i;
+    }
+
+    size_t n_exp, n_out;
+    char *exp = run_at(p, O0, in, sizeof(in), &n_exp);
+    char *out = run_nervc(p, in, sizeof(in), &n_out);
+
+    bool ok = count_flag(p, O2, COPY) == IDIOM_C_BLOCKS && count_flag(p, O2, CMP) == IDIOM_C_BLOCKS
+              && n_out == n_exp && !memcmp(out, exp, n_exp);
+    printf("%-24s%s\n", "idioms in C", ok ? "Correct Output!" : "Inccorect Output!");
+    correct += ok;
+
+    free(exp);
+    free(out);
+    free(p);
+    return correct;
+}
+
+// Loops that run at most once: one ended by a MEM_RANGE over its cell, entered and not, and
+// bodies of nothing but MULs, which need no IF around them
+#define IF_RANGE ",>,<[>>>>>+<<<<<[-]>[-]>[-]>[-]<<<]>>>>>.<<<<.>.>.>."
+#define IF_CASES 4
+const Case if_cases[IF_CASES] = {
+    {"MEM_RANGE ends it", IF_RANGE, "\5\7", 2, 1, IF},
+    {"MEM_RANGE not entered", IF_RANGE, "\0\7", 2, 1, IF},
+    {"MULs only", ",[[->+<]]>.", "\5", 1, -1, IF},
+    {"MUL_VEC only", ",[[->+>++>+++<<<]]>.>.>.", "\5", 1, -1, IF},
+};
+
+int test_if_convert(void)
+{
+    return check_cases(if_cases, IF_CASES);
+}
+
+// Loops the passes after the Optimizer decide about, each has to show up in the report
+#define REPORT_CASES 3
+const char *report_cases[REPORT_CASES][2] = {
+    {"++[>++[>+<-]<-]>>.", "loop 1       unrolled by Const_Prop"},
+    {",>,<[->-<]>[<+>[-]]<.", "loop 2       rewritten by Idioms into a CMP"},
+    {",[>,<[-]]>.", "loop 1       made an IF by If_Convert"},
+};
+
+int test_report(void)
+{
+    int correct = 0;
+
+    for (int i = 0; i < REPORT_CASES; ++i)
+    {
+        char text[4096] = {0};
+        FILE *fp = fmemopen(text, sizeof(text) - 1, "w");
+        Report_To(fp);
+        List_t *tokens = Lexer(report_cases[i][0], O2);
+        Report_Program(tokens);
+        Report_To(NULL);
+        fclose(fp);
+
+        bool ok = strstr(text, report_cases[i][1]) != NULL;
+        printf("%-24s%s\n", report_cases[i][0], ok ? "Correct Output!" : "Inccorect Output!");
+        correct += ok;
+        Destroy(tokens);
+    }
+
+    return correct;
+}
+
+// Lex and optimize a program too big for one thread both ways, the token lists must be the same
+#define PN 4
+int test_parallel(void)
+{
+    int correct = 0;
+
+    // the benchmarks back to back until there is enough to split up
+    char *src = malloc(PAR_LEX_MIN + 2 * BUFF_SIZE), buff[BUFF_SIZE];
+    size_t n = 0;
+    if (!src)
+    {
+        fprintf(stderr, "Could not allocate memory for program\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; n < PAR_LEX_MIN; i = (i + 1) % BN)
+    {
+        if (!Read_BF(benchmarks[i], buff, BUFF_SIZE))
+        {
+            fprintf(stderr, "Could not read: %s\n", benchmarks[i]);
+            exit(EXIT_FAILURE);
+        }
+        strcpy(src + n, buff);
+        n += strlen(buff);
+    }
+
+    for (Opt o = O0; o <= O2; ++o)
+    {
+        Set_Threads(1);
+        List_t *seq = Lexer(src, o);
+        Set_Threads(PN);
+        List_t *par = Lexer(src, o);
+
+        bool ok = len(seq) == len(par) && Program_Hash(seq) == Program_Hash(par);
+        printf("O%d\t%zu tokens\t%s\n", o, len(seq), ok ? "Correct Output!" : "Inccorect Output!");
+        correct += ok;
+
+        Destroy(seq);
+        Destroy(par);
+    }
+
+    Set_Threads(0);
+    free(src);
+    return correct;
+}
+
+// Run generated programs at O1 and O2 and check them against O0
+#define GN 8
+int test_generated(void)
+{
+    int correct = 0;
+
+    for (int i = 0; i < GN; ++i)
+    {
+        // every knob somewhere off its default
+        Gen g = GEN_DEFAULTS;
+        g.seed = i + 1;
+        g.depth = i % 6;
+        g.span = 16 << (i % 4);
+        g.scan = 5 * (i % 3);
+        g.io = 2 + i;
+
+        char *in;
+        size_t in_len, n_exp;
+        char *p = Generate(&g, &in, &in_len);
+        char *exp = Expected(p, in, in_len, &n_exp);
+        bool ok = true;
+
+        for (Opt o = O1; o <= O2; ++o)
+        {
+            List_t *tokens = Lexer(p, o);
+            State_t *s = State_Cons(tokens);
+
+            Feed(s, in, in_len);
+            Close_Input(s);
+            while (Step(s, 1000) != HALTED)
+                ;
+
+            ok = ok && s->out_len == n_exp && !memcmp(s->out, exp, n_exp);
+            State_Destroy(s);
+            Destroy(tokens);
+        }
+
+        printf("seed %d\t%zu chars\t%zu bytes out\t%s\n", i + 1, strlen(p), n_exp, ok ? "Correct Output!" : "Inccorect Output!");
+        correct += ok;
+
+        free(p);
+        free(in);
+        free(exp);
+    }
+
+    return correct;
+}
+
+// Profile a run of a program at O0, where every loop of the source is still there
+static Profile *profile_of(const char *p, const char *in, size_t in_len)
+{
+    List_t *tokens = Lexer(p, O0);
+    State_t *s = State_Cons(tokens);
+
+    Profile_Enable(s);
+    Feed(s, in, in_len);
+    Close_Input(s);
+    while (Step(s, 1 << 20) != HALTED)
+        ;
+
+    Profile *pr = Take_Profile(s, Hash(p, strlen(p)));
+    State_Destroy(s);
+    Destroy(tokens);
+    return pr;
+}
+
+// Profile generated programs, then check they still run right compiled with the profile read back,
+// and that a bad profile is refused, cold loops aren't unrolled and hot ones are compiled before the run
+#define PROFILE_CASES (GN + 3)
+int test_profile(void)
+{
+    int correct = 0;
+
+    for (int i = 0; i < GN; ++i)
+    {
+        Gen g = GEN_DEFAULTS;
+        g.seed = i + 1;
+        g.depth = 2 + i % 4;
+
+        char *in;
+        size_t in_len, n_exp;
+        char *p = Generate(&g, &in, &in_len);
+        char *exp = Expected(p, in, in_len, &n_exp);
+
+        List_t *tokens = Lexer(p, O2);
+        State_t *s = State_Cons(tokens);
+        Profile_Enable(s);
+        Feed(s, in, in_len);
+        Close_Input(s);
+        while (Step(s, 1000) != HALTED)
+            ;
+
+        Profile *pr = Take_Profile(s, Hash(p, strlen(p)));
+        Profile *ld = Save_Profile(pr, "./tmp.prof") ? Load_Profile("./tmp.prof") : NULL;
+        bool ok = s->out_len == n_exp && !memcmp(s->out, exp, n_exp)
+                  && ld && ld->prog == pr->prog && ld->loops == pr->loops
+                  && !memcmp(ld->stats, pr->stats, sizeof(Loop_Stats) * (pr->loops + 1));
+        State_Destroy(s);
+        Destroy(tokens);
+
+        Use_Profile(ld);
+        tokens = Lexer(p, O2);
+        s = State_Cons(tokens);
+        Profile_Warm(s);
+        Feed(s, in, in_len);
+        Close_Input(s);
+        while (Step(s, 1000) != HALTED)
+            ;
+        Use_Profile(NULL);
+
+        ok = ok && s->out_len == n_exp && !memcmp(s->out, exp, n_exp);
+        printf("seed %d\t%zu loops\t%zu bytes out\t%s\n", i + 1, pr->loops, n_exp, ok ? "Correct Output!" : "Inccorect Output!");
+        correct += ok;
+
+        State_Destroy(s);
+        Destroy(tokens);
+        Profile_Destroy(pr);
+        Profile_Destroy(ld);
+        free(p);
+        free(in);
+        free(exp);
+    }
+
+    // more loops than a program can have, reading the stats in would overflow the allocation
+    FILE *fp = fopen("./tmp.prof", "w");
+    fputs("nerv profile\nprogram 0\nloops 18446744073709551615\n5 1 1 1 1 1 0 0\n", fp);
+    fclose(fp);
+    bool ok = !Load_Profile("./tmp.prof");
+    printf("too many loops\t\t%s\n", ok ? "Correct Output!" : "Inccorect Output!");
+    correct += ok;
+
+    // the inner loop has a known trip count, but the profile never saw it run
+    const char *cold = ",[>[-]+++[>.+<-]<[-]]";
+    Profile *pr = profile_of(cold, "\0", 1);
+    ok = count_flag(cold, O2, LOOP_START) == 0;
+    Use_Profile(pr);
+    ok = ok && count_flag(cold, O2, LOOP_START) == 1;
+
+    // and written out as C it is marked unlikely
+    char c_src[4096] = {0};
+    nervc(cold, "./tmp.c", O2);
+    fp = fopen("./tmp.c", "r");
+    ok = ok && fp && fread(c_src, 1, sizeof(c_src) - 1, fp) && strstr(c_src, "while (__builtin_expect(*ptr != 0, 0))");
+    if (fp)
+        fclose(fp);
+    Use_Profile(NULL);
+    Profile_Destroy(pr);
+    printf("cold loop\t\t%s\n", ok ? "Correct Output!" : "Inccorect Output!");
+    correct += ok;
+
+    // the inner loop runs 32 entries of 255 iterations, hot and long enough for native code
+    const char *hot = ",[>,[>+>[-]+<<-]<-]>>.>.";
+    char in[33];
+    in[0] = 32;
+    memset(in + 1, 255, 32);
+    pr = profile_of(hot, in, sizeof(in));
+    Use_Profile(pr);
+
+    List_t *tokens = Lexer(hot, O2);
+    State_t *s = State_Cons(tokens);
+    Profile_Warm(s);
+    size_t ip = 0;
+    while (ip < len(tokens) && (tokens->data[ip]->flag != LOOP_START || tokens->data[ip]->aux != 2))
+        ++ip;
+    ok = ip < len(tokens) && s->hot && s->hot[ip].trace && s->hot[ip].native;
+    Use_Profile(NULL);
+    printf("hot loop\t\t%s\n", ok ? "Correct Output!" : "Inccorect Output!");
+    correct += ok;
+
+    State_Destroy(s);
+    Destroy(tokens);
+    Profile_Destroy(pr);
+    remove("./tmp.prof");
+    return correct;
+}
+
 int main(void)
 {
     printf("Testing Interpreter!\n\n");
     int correct = test_interpreter();
     printf("%.2f%% correct.\n", ((float)correct / (float)BN) * 100);
+
+    printf("\nTesting Step!\n\n");
+    correct = test_step();
+    printf("%.2f%% correct.\n", ((float)correct / (float)BN) * 100);
+
+    printf("\nTesting Server!\n\n");
+    correct = test_server();
+    printf("%.2f%% correct.\n", ((float)correct / (float)SN) * 100);
+
+    printf("\nTesting Snapshots!\n\n");
+    correct = test_snapshot();
+    printf("%.2f%% correct.\n", ((float)correct / (float)CN) * 100);
+
+    printf("\nTesting Constant Propagation!\n\n");
+    correct = test_const_prop();
+    printf("%.2f%% correct.\n", ((float)correct / (float)PROP_CASES) * 100);
+
+    printf("\nTesting PRINT_CONST!\n\n");
+    correct = test_print_const();
+    printf("%.2f%% correct.\n", ((float)correct / (float)PC_CASES) * 100);
+
+    printf("\nTesting Kernels!\n\n");
+    int tested;
+    correct = test_kernels(&tested);
+    printf("%.2f%% correct, %d of %d kernels not supported here.\n", ((float)correct / (float)tested) * 100,
+           KERNEL_COUNT - tested, KERNEL_COUNT);
+
+    printf("\nTesting Vectorize!\n\n");
+    correct = test_vectorize();
+    printf("%.2f%% correct.\n", ((float)correct / (float)VEC_CASES) * 100);
+
+    printf("\nTesting Traces!\n\n");
+    correct = test_traces();
+    printf("%.2f%% correct.\n", ((float)correct / (float)TRACE_CASES) * 100);
+
+    printf("\nTesting JIT!\n\n");
+    correct = test_jit();
+    printf("%.2f%% correct.\n", ((float)correct / (float)HOT_CASES) * 100);
+
+    printf("\nTesting Memo!\n\n");
+    correct = test_memo();
+    printf("%.2f%% correct.\n", ((float)correct / (float)MEMO_CASES) * 100);
+
+    printf("\nTesting Dead Stores!\n\n");
+    correct = test_dead_stores();
+    printf("%.2f%% correct.\n", ((float)correct / (float)DSE_CASES) * 100);
+
+    printf("\nTesting Idioms!\n\n");
+    correct = test_idioms();
+    printf("%.2f%% correct.\n", ((float)correct / (float)IDIOM_CASES) * 100);
+
+    printf("\nTesting If Conversion!\n\n");
+    correct = test_if_convert();
+    printf("%.2f%% correct.\n", ((float)correct / (float)IF_CASES) * 100);
+
+    printf("\nTesting Report!\n\n");
+    correct = test_report();
+    printf("%.2f%% correct.\n", ((float)correct / (float)REPORT_CASES) * 100);
+
+    printf("\nTesting Parallel Lexer!\n\n");
+    correct = test_parallel();
+    printf("%.2f%% correct.\n", ((float)correct / 3.0) * 100);
+
+    printf("\nTesting Generated Programs!\n\n");
+    correct = test_generated();
+    printf("%.2f%% correct.\n", ((float)correct / (float)GN) * 100);
+
+    printf("\nTesting Profiles!\n\n");
+    correct = test_profile();
+    printf("%.2f%% correct.\n", ((float)correct / (float)PROFILE_CASES) * 100);
 }
\ No newline at end of file